@@ -0,0 +1,125 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include <reaver/future.h>
+#include <reaver/thread_pool.h>
+
+#include "benchmark.h"
+
+namespace
+{
+    std::atomic<std::size_t> allocations{ 0 };
+}
+
+void * operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (auto ptr = std::malloc(size ? size : 1))
+    {
+        return ptr;
+    }
+
+    throw std::bad_alloc{};
+}
+
+void operator delete(void * ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void * ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace
+{
+    struct inline_executor : reaver::executor
+    {
+        virtual void push(reaver::function<void ()> f) override
+        {
+            f();
+        }
+    };
+
+    // async(f).then(g).then(h) is three stages; each of them should cost a single allocation at most,
+    // and none at all once the per-thread state pool is warm
+    template<typename F>
+    void count(const char * name, std::size_t chains, F && f)
+    {
+        auto before = allocations.load();
+        f();
+        auto cold = allocations.load() - before;
+
+        before = allocations.load();
+        for (std::size_t i = 0; i < chains; ++i)
+        {
+            f();
+        }
+        auto warm = allocations.load() - before;
+
+        std::printf("%-60s %8.2f allocs/stage (first chain) %8.2f allocs/stage (steady state)\n", name, cold / 3.0, warm / (chains * 3.0));
+    }
+}
+
+int main()
+{
+    auto inline_exec = reaver::make_executor<inline_executor>();
+
+    count("async().then().then(), inline executor", 100000, [&]{
+        auto future = reaver::async(inline_exec, []{ return 1; })
+            .then(inline_exec, [](int i){ return i + 1; })
+            .then(inline_exec, [](int i){ return i + 1; });
+    });
+
+    count("async().then().then() on a pending promise, inline executor", 100000, [&]{
+        auto pair = reaver::make_promise<int>();
+        auto future = pair.future
+            .then(inline_exec, [](int i){ return i + 1; })
+            .then(inline_exec, [](int i){ return i + 1; });
+        pair.promise.set(1);
+    });
+
+    // the thread pool's queue is included here, so some of its allocations show up as well
+    auto pool = reaver::make_executor<reaver::thread_pool>(1);
+    count("async().then().then() + get(), thread_pool(1)", 10000, [&]{
+        reaver::async(pool, []{ return 1; })
+            .then(pool, [](int i){ return i + 1; })
+            .then(pool, [](int i){ return i + 1; })
+            .get();
+    });
+
+    benchmark::run("async().then().then() + get(), thread_pool(1)", 10000, [&]{
+        for (std::size_t i = 0; i < 10000; ++i)
+        {
+            reaver::async(pool, []{ return 1; })
+                .then(pool, [](int i){ return i + 1; })
+                .then(pool, [](int i){ return i + 1; })
+                .get();
+        }
+    });
+}
@@ -0,0 +1,53 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstddef>
+
+namespace benchmark
+{
+    template<typename F>
+    double measure(F && f)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        f();
+        auto end = std::chrono::steady_clock::now();
+
+        return std::chrono::duration<double>(end - begin).count();
+    }
+
+    inline void report(const char * name, std::size_t operations, double seconds)
+    {
+        std::printf("%-60s %12.1f ns/op %16.0f ops/s\n", name, seconds * 1e9 / operations, operations / seconds);
+    }
+
+    template<typename F>
+    void run(const char * name, std::size_t operations, F && f)
+    {
+        // warm up the allocator and the caches first
+        f();
+        report(name, operations, measure(f));
+    }
+}
@@ -0,0 +1,220 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <reaver/future.h>
+#include <reaver/thread_pool.h>
+
+#include "benchmark.h"
+
+namespace
+{
+    // the continuation list as it was before it went lock-free: a state lock, a continuations lock
+    // and a vector of type-erased functions, drained in a loop on completion
+    struct locked_state
+    {
+        std::mutex lock;
+        bool ready = false;
+
+        std::mutex continuations_lock;
+        std::vector<reaver::function<void ()>> continuations;
+
+        template<typename F>
+        void attach(F && f)
+        {
+            std::unique_lock<std::mutex> l{ lock };
+
+            if (ready)
+            {
+                l.unlock();
+                f();
+                return;
+            }
+
+            std::lock_guard<std::mutex> cl{ continuations_lock };
+            continuations.emplace_back(std::forward<F>(f));
+        }
+
+        void set(int)
+        {
+            {
+                std::lock_guard<std::mutex> l{ lock };
+                ready = true;
+            }
+
+            std::vector<reaver::function<void ()>> conts;
+
+            while ([&]{
+                std::lock_guard<std::mutex> cl{ continuations_lock };
+                return !continuations.empty();
+            }())
+            {
+                {
+                    std::lock_guard<std::mutex> cl{ continuations_lock };
+                    std::swap(conts, continuations);
+                }
+
+                for (auto && cont : conts)
+                {
+                    cont();
+                }
+
+                conts.clear();
+            }
+        }
+    };
+
+    using lock_free_state = reaver::_detail::_shared_state<int>;
+
+    std::atomic<std::size_t> counter{ 0 };
+
+    template<typename State>
+    void attach_and_complete(const char * name, std::size_t states, std::size_t per_state)
+    {
+        benchmark::run(name, states * per_state, [&]{
+            for (std::size_t i = 0; i < states; ++i)
+            {
+                State state;
+
+                for (std::size_t j = 0; j < per_state; ++j)
+                {
+                    state.attach([]{ counter.fetch_add(1, std::memory_order_relaxed); });
+                }
+
+                state.set(1);
+            }
+        });
+    }
+
+    template<typename State>
+    void contended_attach(const char * name, std::size_t threads, std::size_t per_thread)
+    {
+        double attach_time = 0;
+        double complete_time = 0;
+
+        for (std::size_t round = 0; round < 2; ++round)
+        {
+            State state;
+            std::atomic<std::size_t> started{ 0 };
+
+            attach_time = benchmark::measure([&]{
+                std::vector<std::thread> workers;
+
+                for (std::size_t i = 0; i < threads; ++i)
+                {
+                    workers.emplace_back([&]{
+                        ++started;
+                        while (started != threads)
+                        {
+                        }
+
+                        for (std::size_t j = 0; j < per_thread; ++j)
+                        {
+                            state.attach([]{ counter.fetch_add(1, std::memory_order_relaxed); });
+                        }
+                    });
+                }
+
+                for (auto && worker : workers)
+                {
+                    worker.join();
+                }
+            });
+
+            complete_time = benchmark::measure([&]{ state.set(1); });
+        }
+
+        std::string prefix = name;
+        benchmark::report((prefix + ", attach").c_str(), threads * per_thread, attach_time);
+        benchmark::report((prefix + ", complete").c_str(), threads * per_thread, complete_time);
+    }
+
+    struct inline_executor : reaver::executor
+    {
+        virtual void push(reaver::function<void ()> f) override
+        {
+            f();
+        }
+    };
+}
+
+int main()
+{
+    attach_and_complete<locked_state>("locked: attach 4 + complete", 100000, 4);
+    attach_and_complete<lock_free_state>("lock-free: attach 4 + complete", 100000, 4);
+
+    attach_and_complete<locked_state>("locked: attach 1 + complete", 400000, 1);
+    attach_and_complete<lock_free_state>("lock-free: attach 1 + complete", 400000, 1);
+
+    auto threads = std::max(2u, std::thread::hardware_concurrency());
+
+    contended_attach<locked_state>("locked: contended", threads, 100000);
+    contended_attach<lock_free_state>("lock-free: contended", threads, 100000);
+
+    auto exec = reaver::make_executor<inline_executor>();
+    benchmark::run("future: then on a pending future + set", 100000, [&]{
+        for (std::size_t i = 0; i < 100000; ++i)
+        {
+            auto pair = reaver::make_promise<int>();
+            auto future = pair.future.then(exec, [](int i){ return i + 1; });
+            pair.promise.set(i);
+        }
+    });
+
+    benchmark::run("future: then on a ready future", 100000, [&]{
+        auto ready = reaver::make_ready_future(1);
+        for (std::size_t i = 0; i < 100000; ++i)
+        {
+            auto future = ready.then(exec, [](int i){ return i + 1; });
+        }
+    });
+
+    // short transform stages on a real pool: every then() is a queue round-trip, every then_inline() is not
+    auto pool = reaver::make_executor<reaver::thread_pool>(1);
+    benchmark::run("thread_pool: async + 4 x then + get", 10000, [&]{
+        for (std::size_t i = 0; i < 10000; ++i)
+        {
+            reaver::async(pool, []{ return 1; })
+                .then([](int i){ return i + 1; })
+                .then([](int i){ return i + 1; })
+                .then([](int i){ return i + 1; })
+                .then([](int i){ return i + 1; })
+                .get();
+        }
+    });
+
+    benchmark::run("thread_pool: async + 4 x then_inline + get", 10000, [&]{
+        for (std::size_t i = 0; i < 10000; ++i)
+        {
+            reaver::async(pool, []{ return 1; })
+                .then_inline([](int i){ return i + 1; })
+                .then_inline([](int i){ return i + 1; })
+                .then_inline([](int i){ return i + 1; })
+                .then_inline([](int i){ return i + 1; })
+                .get();
+        }
+    });
+}
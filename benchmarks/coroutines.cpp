@@ -0,0 +1,98 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+
+#include <cstdio>
+
+#include <reaver/future.h>
+#include <reaver/coroutine.h>
+
+#include "benchmark.h"
+
+#ifdef __cpp_impl_coroutine
+
+namespace
+{
+    struct inline_executor : reaver::executor
+    {
+        virtual void push(reaver::function<void ()> f) override
+        {
+            f();
+        }
+    };
+
+    reaver::future<int> ten_stages(reaver::future<int> input)
+    {
+        int value = co_await input;
+
+        for (std::size_t i = 0; i < 10; ++i)
+        {
+            value = co_await reaver::make_ready_future(value + 1);
+        }
+
+        co_return value;
+    }
+}
+
+int main()
+{
+    auto exec = reaver::make_executor<inline_executor>();
+
+    benchmark::run("then: 10 stages on a pending future + set + get", 100000, [&]{
+        for (std::size_t i = 0; i < 100000; ++i)
+        {
+            auto pair = reaver::make_promise<int>();
+            auto future = pair.future
+                .then(exec, [](int i){ return i + 1; })
+                .then(exec, [](int i){ return i + 1; })
+                .then(exec, [](int i){ return i + 1; })
+                .then(exec, [](int i){ return i + 1; })
+                .then(exec, [](int i){ return i + 1; })
+                .then(exec, [](int i){ return i + 1; })
+                .then(exec, [](int i){ return i + 1; })
+                .then(exec, [](int i){ return i + 1; })
+                .then(exec, [](int i){ return i + 1; })
+                .then(exec, [](int i){ return i + 1; });
+            pair.promise.set(static_cast<int>(i));
+            future.get();
+        }
+    });
+
+    // one co_await suspends on the pending future; the ten stages await ready futures, which doesn't suspend
+    benchmark::run("coroutine: 10 stages on a pending future + set + get", 100000, [&]{
+        for (std::size_t i = 0; i < 100000; ++i)
+        {
+            auto pair = reaver::make_promise<int>();
+            auto future = ten_stages(std::move(pair.future));
+            pair.promise.set(static_cast<int>(i));
+            future.get();
+        }
+    });
+}
+
+#else
+
+int main()
+{
+    std::printf("coroutines are not supported by this compiler; build with -std=c++20 to run this benchmark\n");
+}
+
+#endif
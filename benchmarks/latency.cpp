@@ -0,0 +1,81 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include <reaver/thread_pool.h>
+
+#include "benchmark.h"
+
+namespace
+{
+    using clock = std::chrono::steady_clock;
+
+    // pushes a single task after the worker has been idle for `gap`, and measures how long it takes until the task starts running
+    void latency(const char * name, reaver::idle_policy policy, std::chrono::microseconds gap, std::size_t samples)
+    {
+        reaver::thread_pool pool{ 1, policy };
+        std::vector<double> results;
+        results.reserve(samples);
+
+        for (std::size_t i = 0; i < samples; ++i)
+        {
+            std::this_thread::sleep_for(gap);
+
+            std::atomic<bool> done{ false };
+            clock::time_point started;
+
+            auto pushed = clock::now();
+            pool.push(reaver::function<void ()>{ [&]{
+                started = clock::now();
+                done.store(true, std::memory_order_release);
+            } });
+
+            while (!done.load(std::memory_order_acquire))
+            {
+            }
+
+            results.push_back(std::chrono::duration<double, std::nano>(started - pushed).count());
+        }
+
+        std::sort(results.begin(), results.end());
+        std::printf("%-60s %10.0f ns p50 %10.0f ns p99\n", name, results[samples / 2], results[samples * 99 / 100]);
+    }
+}
+
+int main()
+{
+    for (auto gap : { std::chrono::microseconds{ 2 }, std::chrono::microseconds{ 50 } })
+    {
+        std::printf("idle for %d us before the push:\n", static_cast<int>(gap.count()));
+
+        latency("park immediately", {}, gap, 2000);
+        latency("spin 1000, then park", { 1000, 0 }, gap, 2000);
+        latency("yield 100, then park", { 0, 100 }, gap, 2000);
+        latency("spin 1000, yield 100, then park", { 1000, 100 }, gap, 2000);
+    }
+}
@@ -0,0 +1,111 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <reaver/future.h>
+#include <reaver/thread_pool.h>
+
+#include "benchmark.h"
+
+namespace
+{
+    // every input gets a single continuation writing into its own preallocated slot, so the cost per input
+    // should stay flat as the fan-in grows
+    template<typename F>
+    void scale(const char * name, F && f)
+    {
+        for (std::size_t size : { 1000, 10000, 100000 })
+        {
+            auto label = std::string{ name } + ", " + std::to_string(size) + " inputs";
+            benchmark::run(label.c_str(), size, [&]{ f(size); });
+        }
+    }
+}
+
+int main()
+{
+    auto inline_exec = reaver::make_executor<reaver::inline_executor>();
+
+    scale("when_all(vector<future<int>>) on pending promises", [&](std::size_t size) {
+        std::vector<reaver::manual_promise<int>> promises;
+        std::vector<reaver::future<int>> futures;
+        promises.reserve(size);
+        futures.reserve(size);
+
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            auto pair = reaver::make_promise<int>();
+            promises.push_back(std::move(pair.promise));
+            futures.push_back(std::move(pair.future));
+        }
+
+        auto all = reaver::when_all(inline_exec, futures);
+        futures.clear();
+
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            promises[i].set(static_cast<int>(i));
+        }
+
+        all.get();
+    });
+
+    scale("when_all(vector<future<>>) on pending promises", [&](std::size_t size) {
+        std::vector<reaver::manual_promise<void>> promises;
+        std::vector<reaver::future<>> futures;
+        promises.reserve(size);
+        futures.reserve(size);
+
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            auto pair = reaver::make_promise<void>();
+            promises.push_back(std::move(pair.promise));
+            futures.push_back(std::move(pair.future));
+        }
+
+        auto all = reaver::when_all(inline_exec, futures);
+        futures.clear();
+
+        for (auto & promise : promises)
+        {
+            promise.set();
+        }
+
+        all.get();
+    });
+
+    auto pool = reaver::make_executor<reaver::thread_pool>(4);
+    scale("when_all(vector<future<int>>) of async() on thread_pool(4)", [&](std::size_t size) {
+        std::vector<reaver::future<int>> futures;
+        futures.reserve(size);
+
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            futures.push_back(reaver::async(pool, [i]{ return static_cast<int>(i); }));
+        }
+
+        reaver::when_all(pool, futures).get();
+    });
+}
@@ -0,0 +1,152 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cstddef>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace reaver { inline namespace _v1
+{
+    // parses the list format used by the kernel in /sys, e.g. "0-3,8,10-11"
+    // malformed entries are skipped
+    inline std::vector<std::size_t> parse_cpu_list(const std::string & list)
+    {
+        std::vector<std::size_t> ret;
+
+        std::istringstream stream{ list };
+        std::string range;
+
+        while (std::getline(stream, range, ','))
+        {
+            std::size_t first = 0, last = 0;
+            char dash = 0;
+
+            std::istringstream range_stream{ range };
+            if (!(range_stream >> first))
+            {
+                continue;
+            }
+
+            last = first;
+            if (range_stream >> dash && (dash != '-' || !(range_stream >> last) || last < first))
+            {
+                continue;
+            }
+
+            for (auto cpu = first; cpu <= last; ++cpu)
+            {
+                ret.push_back(cpu);
+            }
+        }
+
+        return ret;
+    }
+
+    struct numa_node
+    {
+        std::size_t id;
+        std::vector<std::size_t> cpus;
+    };
+
+    // reads the NUMA topology from /sys/devices/system/node
+    // if it's not available (not on Linux, or a kernel without NUMA support), returns a single node with an empty cpu list,
+    // meaning "no placement"
+    inline std::vector<numa_node> numa_topology()
+    {
+        std::vector<numa_node> ret;
+
+        std::ifstream online{ "/sys/devices/system/node/online" };
+        std::string list;
+
+        if (online && std::getline(online, list))
+        {
+            for (auto id : parse_cpu_list(list))
+            {
+                std::ifstream cpulist{ "/sys/devices/system/node/node" + std::to_string(id) + "/cpulist" };
+                std::string cpus;
+
+                if (cpulist && std::getline(cpulist, cpus))
+                {
+                    auto parsed = parse_cpu_list(cpus);
+                    // memory-only nodes have no cpus to run workers on
+                    if (parsed.size())
+                    {
+                        ret.push_back({ id, std::move(parsed) });
+                    }
+                }
+            }
+        }
+
+        if (ret.empty())
+        {
+            ret.push_back({ 0, {} });
+        }
+
+        return ret;
+    }
+
+    // returns the cpu the calling thread is running on, or -1 if it can't be determined
+    inline long current_cpu()
+    {
+#ifdef __linux__
+        return sched_getcpu();
+#else
+        return -1;
+#endif
+    }
+
+    // restricts the calling thread to the given set of cpus; an empty set means no restriction
+    // returns false if the affinity couldn't be set
+    inline bool pin_current_thread(const std::vector<std::size_t> & cpus)
+    {
+        if (cpus.empty())
+        {
+            return true;
+        }
+
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+
+        for (auto cpu : cpus)
+        {
+            if (cpu < CPU_SETSIZE)
+            {
+                CPU_SET(cpu, &set);
+            }
+        }
+
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        return false;
+#endif
+    }
+}}
@@ -0,0 +1,117 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+
+#pragma once
+
+#include <memory>
+#include <atomic>
+#include <utility>
+
+#include "exception.h"
+
+namespace reaver { inline namespace _v1
+{
+    class cancelled : public exception
+    {
+    public:
+        cancelled() : exception{ logger::error }
+        {
+            *this << "the task has been cancelled.";
+        }
+    };
+
+    // observes a cancellation_source; a default constructed token is never cancelled
+    class cancellation_token
+    {
+    public:
+        cancellation_token() = default;
+
+        bool is_cancelled() const
+        {
+            return _flag && _flag->load(std::memory_order_acquire);
+        }
+
+        // for long running tasks to check at convenient points
+        void throw_if_cancelled() const
+        {
+            if (is_cancelled())
+            {
+                throw cancelled{};
+            }
+        }
+
+    private:
+        friend class cancellation_source;
+
+        cancellation_token(std::shared_ptr<std::atomic<bool>> flag) : _flag{ std::move(flag) }
+        {
+        }
+
+        std::shared_ptr<std::atomic<bool>> _flag;
+    };
+
+    class cancellation_source
+    {
+    public:
+        cancellation_token token() const
+        {
+            return { _flag };
+        }
+
+        void cancel()
+        {
+            _flag->store(true, std::memory_order_release);
+        }
+
+        bool is_cancelled() const
+        {
+            return _flag->load(std::memory_order_acquire);
+        }
+
+    private:
+        std::shared_ptr<std::atomic<bool>> _flag = std::make_shared<std::atomic<bool>>(false);
+    };
+
+    namespace _detail
+    {
+        template<typename F>
+        struct _cancellable
+        {
+            template<typename... Args>
+            auto operator()(Args &&... args) -> decltype(std::declval<F &>()(std::forward<Args>(args)...))
+            {
+                token.throw_if_cancelled();
+                return f(std::forward<Args>(args)...);
+            }
+
+            cancellation_token token;
+            F f;
+        };
+    }
+
+    // wraps f so that it throws cancelled instead of running, if token is cancelled by the time it's called
+    template<typename F>
+    auto with_cancellation(cancellation_token token, F && f)
+    {
+        return _detail::_cancellable<std::decay_t<F>>{ std::move(token), std::forward<F>(f) };
+    }
+}}
@@ -0,0 +1,204 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+
+#pragma once
+
+// requires a compiler with C++20 coroutines; empty otherwise
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+#include <atomic>
+#include <memory>
+#include <exception>
+
+#include "future.h"
+
+namespace reaver { inline namespace _v1
+{
+    namespace _detail
+    {
+        // the coroutine starts running right away, like async() on an inline executor, and co_return sets the state of
+        // the returned future directly
+        template<typename T>
+        class _coroutine_promise_base
+        {
+        public:
+            future<T> get_return_object()
+            {
+                return std::move(_pair.future);
+            }
+
+            std::suspend_never initial_suspend() noexcept
+            {
+                return {};
+            }
+
+            std::suspend_never final_suspend() noexcept
+            {
+                return {};
+            }
+
+            void unhandled_exception()
+            {
+                _pair.promise.set(std::current_exception());
+            }
+
+        protected:
+            future_promise_pair<T> _pair = make_promise<T>();
+        };
+
+        template<typename T>
+        class _coroutine_promise : public _coroutine_promise_base<T>
+        {
+        public:
+            void return_value(T value)
+            {
+                this->_pair.promise.set(std::move(value));
+            }
+        };
+
+        template<>
+        class _coroutine_promise<void> : public _coroutine_promise_base<void>
+        {
+        public:
+            void return_void()
+            {
+                this->_pair.promise.set();
+            }
+        };
+
+        // a ready future is not suspended on
+        // otherwise, the coroutine is resumed on the chosen executor, or if there isn't one, on the scheduler of the future,
+        // or if there isn't one either (e.g. for futures of manual promises), inline on the thread that completes it
+        template<typename T>
+        class _future_awaiter
+        {
+        public:
+            _future_awaiter(future<T> input, std::shared_ptr<executor> sched) : _future{ std::move(input) }, _sched{ std::move(sched) }
+            {
+            }
+
+            bool await_ready() const
+            {
+                return _future.is_ready();
+            }
+
+            // returns false, and so doesn't suspend, if the future became ready in the meantime
+            bool await_suspend(std::coroutine_handle<> handle)
+            {
+                _handle = handle;
+                _suspended = true;
+
+                _observer = _observe(_future,
+                    [this](auto value) {
+                        _value = std::move(value);
+                        _resume();
+                    },
+
+                    [this](std::exception_ptr exception) {
+                        _exception = exception;
+                        _resume();
+                    }
+                );
+
+                return !_arrived.exchange(true, std::memory_order_acq_rel);
+            }
+
+            T await_resume()
+            {
+                if (!_suspended)
+                {
+                    return _future.get();
+                }
+
+                if (_exception)
+                {
+                    std::rethrow_exception(_exception);
+                }
+
+                return static_cast<T>(std::move(*_value));
+            }
+
+        private:
+            void _resume()
+            {
+                // the side that comes second resumes the coroutine; if that's await_suspend, it just doesn't suspend
+                if (!_arrived.exchange(true, std::memory_order_acq_rel))
+                {
+                    return;
+                }
+
+                // once the coroutine is resumed, this awaiter is gone, but the observer calling this must outlive the call
+                auto observer = std::move(_observer);
+                auto handle = _handle;
+                auto sched = _sched ? _sched : _future.scheduler();
+
+                if (!sched)
+                {
+                    handle.resume();
+                    return;
+                }
+
+                sched->push([handle]{ handle.resume(); });
+            }
+
+            future<T> _future;
+            std::shared_ptr<executor> _sched;
+
+            std::coroutine_handle<> _handle;
+            bool _suspended = false;
+            std::atomic<bool> _arrived{ false };
+            optional<future<>> _observer;
+
+            optional<typename _replace_void<T>::type> _value;
+            std::exception_ptr _exception;
+        };
+
+        template<typename T>
+        struct _resume_on
+        {
+            // a member, since argument-dependent lookup for _resume_on only searches _detail
+            auto operator co_await() &&
+            {
+                return _future_awaiter<T>{ std::move(input), std::move(sched) };
+            }
+
+            future<T> input;
+            std::shared_ptr<executor> sched;
+        };
+    }
+
+    template<typename T>
+    auto operator co_await(future<T> input)
+    {
+        return _detail::_future_awaiter<T>{ std::move(input), nullptr };
+    }
+
+    // co_await resume_on(sched, future) resumes the coroutine on sched, instead of the scheduler of the future
+    template<typename T>
+    auto resume_on(std::shared_ptr<executor> sched, future<T> input)
+    {
+        return _detail::_resume_on<T>{ std::move(input), std::move(sched) };
+    }
+}}
+
+#endif
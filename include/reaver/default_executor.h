@@ -23,10 +23,12 @@
 #pragma once
 
 #include "thread_pool.h"
+#include "numa_thread_pool.h"
 
 namespace reaver { inline namespace _v1
 {
-    // defaults to a thread pool with thread count of std::thread::hardware_concurrency()
+    // defaults to a thread pool with thread count of std::thread::hardware_concurrency(); on machines with more than one
+    // NUMA node, to a numa_thread_pool with one worker per cpu of each node
     // the recommended way to make it be a thread pool with a different thread count is to create it manually and pass into this function
     // after the first call to default_executor, the default executor cannot be changed
     inline std::shared_ptr<executor> default_executor(std::shared_ptr<executor> custom = nullptr)
@@ -37,6 +39,12 @@ namespace reaver { inline namespace _v1
                 return std::move(custom);
             }
 
+            auto topology = numa_topology();
+            if (topology.size() > 1)
+            {
+                return std::make_shared<numa_thread_pool>(std::move(topology));
+            }
+
             return std::make_shared<thread_pool>(std::thread::hardware_concurrency());
         }();
 
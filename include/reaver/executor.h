@@ -22,6 +22,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include "function.h"
 
 namespace reaver { inline namespace _v1
@@ -32,6 +34,15 @@ namespace reaver { inline namespace _v1
         virtual ~executor() {}
 
         virtual void push(reaver::function<void ()> f) = 0;
+
+        // executors with a shared queue should override this, to take their lock and wake their workers once per batch
+        virtual void push_bulk(std::vector<reaver::function<void ()>> tasks)
+        {
+            for (auto && task : tasks)
+            {
+                push(std::move(task));
+            }
+        }
     };
 }}
 
@@ -22,8 +22,12 @@
 
 #pragma once
 
+#include <cstddef>
+#include <new>
+
 #include "variant.h"
 #include "traits.h"
+#include "id.h"
 
 namespace reaver { inline namespace _v1
 {
@@ -90,7 +94,7 @@ namespace reaver { inline namespace _v1
 //            && std::is_convertible<decltype(std::declval<T &>()(std::declval<Args>()...)), Result>::value
 //            && std::is_convertible<decltype(std::declval<const T &>()(std::declval<Args>()...)), Result>::value,
             int>::type = 0>
-        function(T t) : _context{ reinterpret_cast<void *>(new _invoker<T>{ std::move(t) }) }, _fptr{ _erased_invoker{ _context, &_invoker<T>::call_lvalue_ref, &_invoker<T>::call_rvalue_ref, &_invoker<T>::call_const_ref, &_invoker<T>::dtor } }
+        function(T t) : _fptr{ _erased_invoker{ id<T>(), std::move(t) } }
         {
         }
 
@@ -148,30 +152,69 @@ namespace reaver { inline namespace _v1
                 delete reinterpret_cast<_invoker *>(context);
             }
 
+            static void destroy(void * context)
+            {
+                reinterpret_cast<_invoker *>(context)->~_invoker();
+            }
+
+            static void relocate(void * from, void * to)
+            {
+                auto & source = *reinterpret_cast<_invoker *>(from);
+                new (to) _invoker{ std::move(source._value) };
+                source.~_invoker();
+            }
+
         private:
             T _value;
         };
 
+        // small function objects are stored in place; this keeps the closures pushed to executors off the heap
+        static constexpr std::size_t _buffer_size = 4 * sizeof(void *);
+
+        template<typename T>
+        using _is_local = std::integral_constant<bool,
+            sizeof(_invoker<T>) <= _buffer_size
+                && alignof(_invoker<T>) <= alignof(void *)
+                && std::is_nothrow_move_constructible<T>::value
+        >;
+
         class _erased_invoker
         {
         public:
             using dtor_type = void (*)(void *);
+            using relocate_type = void (*)(void *, void *);
             using erased_function = Result (*)(void *, Args...);
 
-            _erased_invoker(void * context, erased_function lvalue_ref, erased_function rvalue_ref, erased_function const_ref, dtor_type dtor) : _lvalue_ref{ lvalue_ref }, _rvalue_ref{ rvalue_ref }, _const_ref{ const_ref }, _dtor{ dtor }, _context{ context }
+            template<typename T, typename std::enable_if<_is_local<T>::value, int>::type = 0>
+            _erased_invoker(id<T>, T value) : _lvalue_ref{ &_invoker<T>::call_lvalue_ref }, _rvalue_ref{ &_invoker<T>::call_rvalue_ref }, _const_ref{ &_invoker<T>::call_const_ref }, _dtor{ &_invoker<T>::destroy }, _relocate{ &_invoker<T>::relocate }, _context{ &_buffer }
+            {
+                new (&_buffer) _invoker<T>{ std::move(value) };
+            }
+
+            template<typename T, typename std::enable_if<!_is_local<T>::value, int>::type = 0>
+            _erased_invoker(id<T>, T value) : _lvalue_ref{ &_invoker<T>::call_lvalue_ref }, _rvalue_ref{ &_invoker<T>::call_rvalue_ref }, _const_ref{ &_invoker<T>::call_const_ref }, _dtor{ &_invoker<T>::dtor }, _relocate{ nullptr }, _context{ new _invoker<T>{ std::move(value) } }
             {
             }
 
             _erased_invoker(const _erased_invoker &) = delete;
 
-            _erased_invoker(_erased_invoker && other) noexcept : _lvalue_ref{ other._lvalue_ref }, _rvalue_ref{other._rvalue_ref }, _const_ref{ other._const_ref }, _dtor{ other._dtor }, _context{ other._context }
+            _erased_invoker(_erased_invoker && other) noexcept : _lvalue_ref{ other._lvalue_ref }, _rvalue_ref{other._rvalue_ref }, _const_ref{ other._const_ref }, _dtor{ other._dtor }, _relocate{ other._relocate }, _context{ other._context }
             {
+                if (_context && _relocate)
+                {
+                    _relocate(other._context, &_buffer);
+                    _context = &_buffer;
+                }
+
                 other._context = nullptr;
             }
 
             ~_erased_invoker()
             {
-                _dtor(_context);
+                if (_context)
+                {
+                    _dtor(_context);
+                }
             }
 
             Result operator()(Args... args) &
@@ -198,12 +241,13 @@ namespace reaver { inline namespace _v1
             erased_function _const_ref;
 
             dtor_type _dtor;
+            // null when the function object lives on the heap
+            relocate_type _relocate;
 
             void * _context;
+            std::aligned_storage_t<_buffer_size, alignof(void *)> _buffer;
         };
 
-        void * _context = nullptr;
-
         variant<
             _free_function,
             _erased_invoker
@@ -25,6 +25,11 @@
 #include <memory>
 #include <exception>
 #include <type_traits>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <new>
 
 #include "exception.h"
 #include "optional.h"
@@ -35,8 +40,12 @@
 #include "function.h"
 #include "executor.h"
 #include "default_executor.h"
+#include "inline_executor.h"
 #include "static_if.h"
 #include "expected.h"
+#include "cancellation.h"
+#include "manual.h"
+#include "tls.h"
 
 namespace reaver { inline namespace _v1
 {
@@ -66,9 +75,21 @@ namespace reaver { inline namespace _v1
         }
     };
 
+    class future_value_moved : public exception
+    {
+    public:
+        future_value_moved() : exception{ logger::error }
+        {
+            *this << "attempted to get a noncopyable value that has already been moved out of another future.";
+        }
+    };
+
     template<typename T = void>
     class future;
 
+    template<typename T = void>
+    class shared_future;
+
     template<typename T>
     struct future_package_pair;
 
@@ -81,62 +102,308 @@ namespace reaver { inline namespace _v1
     template<typename T>
     future_promise_pair<T> make_promise();
 
+#ifdef __cpp_impl_coroutine
+    namespace _detail
+    {
+        // defined in coroutine.h
+        template<typename T>
+        class _coroutine_promise;
+    }
+#endif
+
     namespace _detail
     {
         template<typename T>
         struct _shared_state;
 
-        using _continuation_type = reaver::function<void ()>;
+        template<typename U, typename T, typename F, bool Adopt = false>
+        class _continuation_state;
+
+        template<typename T>
+        class _future_ptr;
+
+        // the value type of the future a continuation returning R produces; with Unwrap, a returned future is adopted
+        template<typename R, bool Unwrap>
+        struct _unwrap_result
+        {
+            using type = R;
+            static constexpr bool adopt = false;
+        };
+
+        template<typename R>
+        struct _unwrap_result<future<R>, true>
+        {
+            using type = R;
+            static constexpr bool adopt = true;
+        };
+
+        // continuations of a state form an intrusive, singly-linked stack
+        // a node is either run or discarded exactly once, and disposes of itself when it is
+        class _continuation_node
+        {
+        public:
+            virtual ~_continuation_node() = default;
+
+            virtual void run() = 0;
+
+            // called instead of run() when the state dies without being completed
+            virtual void discard()
+            {
+                delete this;
+            }
+
+            _continuation_node * next = nullptr;
+        };
+
+        template<typename F>
+        class _continuation : public _continuation_node
+        {
+        public:
+            _continuation(F f) : _f{ std::move(f) }
+            {
+            }
+
+            virtual void run() override
+            {
+                std::unique_ptr<_continuation> self{ this };
+                _f();
+            }
+
+        private:
+            F _f;
+        };
+
+        template<typename F>
+        _continuation_node * _make_continuation(F && f)
+        {
+            return new _continuation<std::decay_t<F>>{ std::forward<F>(f) };
+        }
 
-        template<typename T, typename F, typename std::enable_if<std::is_void<T>::value || std::is_copy_constructible<T>::value, int>::type = 0>
-        void _add_continuation(_shared_state<T> & state, F && f)
+        // the head of the stack of a state that has already been completed
+        // never a valid node address, since nodes are at least pointer-aligned
+        inline _continuation_node * _completed_tag()
         {
-            std::lock_guard<std::mutex> lock{ state.continuations_lock };
-            state.continuations.emplace_back(_continuation_type{ std::forward<F>(f) });
+            return reinterpret_cast<_continuation_node *>(std::uintptr_t{ 1 });
         }
 
-        template<typename T, typename F, typename std::enable_if<!std::is_void<T>::value && !std::is_copy_constructible<T>::value, int>::type = 0>
-        void _add_continuation(_shared_state<T> & state, F && f)
+        // the blocking waiters of a state share a single one of these; it is attached to the stack once,
+        // and is owned by the state rather than by the stack, so running or discarding it doesn't free it
+        class _waiter : public _continuation_node
         {
-            std::lock_guard<std::mutex> lock{ state.continuations_lock };
-            if (state.continuations)
+        public:
+            virtual void run() override
             {
-                throw multiple_noncopyable_continuations{};
-                return;
+                std::lock_guard<std::mutex> lock{ _lock };
+                _ready = true;
+                _condition.notify_all();
+            }
+
+            virtual void discard() override
+            {
+            }
+
+            void wait()
+            {
+                std::unique_lock<std::mutex> lock{ _lock };
+                _condition.wait(lock, [&]{ return _ready; });
+            }
+
+            template<typename Clock, typename Duration>
+            bool wait_until(const std::chrono::time_point<Clock, Duration> & time)
+            {
+                std::unique_lock<std::mutex> lock{ _lock };
+                return _condition.wait_until(lock, time, [&]{ return _ready; });
+            }
+
+        private:
+            std::mutex _lock;
+            std::condition_variable _condition;
+            bool _ready = false;
+        };
+
+        // a per-thread cache of memory blocks for shared states, so that a steady stream of futures doesn't keep
+        // going to the global allocator; blocks are sorted into size classes, and are returned to the cache
+        // of the thread that frees them, up to a limit per class
+        // define REAVER_NO_STATE_POOL to allocate every state straight from the global allocator instead
+        class _state_pool
+        {
+            struct _block
+            {
+                _block * next;
+            };
+
+            static constexpr std::size_t _granularity = 64;
+            static constexpr std::size_t _class_count = 8;
+            static constexpr std::size_t _max_cached = 64;
+
+        public:
+            ~_state_pool()
+            {
+                for (auto head : _free)
+                {
+                    while (head)
+                    {
+                        auto next = head->next;
+                        ::operator delete(head);
+                        head = next;
+                    }
+                }
+            }
+
+            static void * allocate(std::size_t size)
+            {
+#ifndef REAVER_NO_STATE_POOL
+                auto index = _class(size);
+                if (index < _class_count)
+                {
+                    auto & pool = _instance();
+                    if (auto block = pool._free[index])
+                    {
+                        pool._free[index] = block->next;
+                        --pool._cached[index];
+                        return block;
+                    }
+
+                    // always allocate the whole block, so that it can be reused for anything in its class
+                    return ::operator new((index + 1) * _granularity);
+                }
+#endif
+
+                return ::operator new(size);
+            }
+
+            static void deallocate(void * ptr, std::size_t size)
+            {
+#ifndef REAVER_NO_STATE_POOL
+                auto index = _class(size);
+                if (index < _class_count)
+                {
+                    auto & pool = _instance();
+                    if (pool._cached[index] < _max_cached)
+                    {
+                        auto block = reinterpret_cast<_block *>(ptr);
+                        block->next = pool._free[index];
+                        pool._free[index] = block;
+                        ++pool._cached[index];
+                        return;
+                    }
+                }
+#endif
+
+                ::operator delete(ptr);
+            }
+
+        private:
+            static std::size_t _class(std::size_t size)
+            {
+                return (size + _granularity - 1) / _granularity - 1;
+            }
+
+            static _state_pool & _instance()
+            {
+                static tls_variable<_state_pool *> current{ nullptr, [](void * pool){ delete reinterpret_cast<_state_pool *>(pool); } };
+
+                _state_pool * pool = current;
+                if (!pool)
+                {
+                    pool = new _state_pool{};
+                    current = pool;
+                }
+
+                return *pool;
+            }
+
+            _block * _free[_class_count] = {};
+            std::size_t _cached[_class_count] = {};
+        };
+
+        template<typename T>
+        class _state_allocator
+        {
+        public:
+            using value_type = T;
+
+            _state_allocator() = default;
+
+            template<typename U>
+            _state_allocator(const _state_allocator<U> &)
+            {
+            }
+
+            T * allocate(std::size_t n)
+            {
+                return reinterpret_cast<T *>(_state_pool::allocate(n * sizeof(T)));
+            }
+
+            void deallocate(T * ptr, std::size_t n)
+            {
+                _state_pool::deallocate(ptr, n * sizeof(T));
+            }
+
+            template<typename U>
+            bool operator==(const _state_allocator<U> &) const
+            {
+                return true;
             }
 
-            state.continuations = _continuation_type{ std::forward<F>(f) };
+            template<typename U>
+            bool operator!=(const _state_allocator<U> &) const
+            {
+                return false;
+            }
+        };
+
+        // the control block, the state and its callable all end up in a single allocation
+        template<typename State, typename... Args>
+        std::shared_ptr<State> _allocate_state(Args &&... args)
+        {
+            return std::allocate_shared<State>(_state_allocator<State>{}, std::forward<Args>(args)...);
+        }
+
+        template<typename T, typename std::enable_if<std::is_void<T>::value || std::is_copy_constructible<T>::value, int>::type = 0>
+        void _reserve_continuation(_shared_state<T> &)
+        {
+        }
+
+        template<typename T, typename std::enable_if<!std::is_void<T>::value && !std::is_copy_constructible<T>::value, int>::type = 0>
+        void _reserve_continuation(_shared_state<T> & state)
+        {
+            if (state.has_continuation.exchange(true))
+            {
+                throw multiple_noncopyable_continuations{};
+            }
         }
 
         template<typename T>
         bool _is_valid(_shared_state<T> & state)
         {
-            return state.value.index() != 2 || state.function;
+            return !state.is_ready() || state.value.index() != 2;
         }
 
         template<typename T>
         bool _is_pending(_shared_state<T> & state)
         {
-            return state.value.index() == 2 && state.function;
+            return !state.is_ready();
         }
 
-        template<typename... Args, typename std::enable_if<all_of<std::is_copy_constructible<Args>::value...>::value, int>::type = 0>
-        auto _move_or_copy(variant<Args...> & v, bool move)
+        // takes the value out of the variant of a state, leaving it empty when it's moved
+        template<typename T, typename... Args, typename std::enable_if<std::is_copy_constructible<T>::value, int>::type = 0>
+        T _move_or_copy(variant<T, Args...> & v, bool move)
         {
-            if (move)
+            if (!move)
             {
-                auto ret = std::move(v);
-                v = none;
-                return ret;
+                return reaver::get<0>(v);
             }
 
-            return v;
+            T ret = std::move(reaver::get<0>(v));
+            v = none;
+            return ret;
         }
 
-        template<typename... Args, typename std::enable_if<!all_of<std::is_copy_constructible<Args>::value...>::value, int>::type = 0>
-        auto _move_or_copy(variant<Args...> & v, bool)
+        template<typename T, typename... Args, typename std::enable_if<!std::is_copy_constructible<T>::value, int>::type = 0>
+        T _move_or_copy(variant<T, Args...> & v, bool)
         {
-            auto ret = std::move(v);
+            T ret = std::move(reaver::get<0>(v));
             v = none;
             return ret;
         }
@@ -181,287 +448,623 @@ namespace reaver { inline namespace _v1
             return _wrap_impl<T>::wrap(std::forward<F>(f));
         }
 
+        // calls a task, capturing either its result or the exception it threw
+        template<typename T>
+        struct _invoke_task_impl
+        {
+            template<typename F, typename... Args>
+            static variant<T, std::exception_ptr> call(F & f, Args &&... args)
+            {
+                try
+                {
+                    return variant<T, std::exception_ptr>{ f(std::forward<Args>(args)...) };
+                }
+
+                catch (...)
+                {
+                    return variant<T, std::exception_ptr>{ std::current_exception() };
+                }
+            }
+        };
+
+        template<>
+        struct _invoke_task_impl<void>
+        {
+            template<typename F, typename... Args>
+            static variant<ready_type, std::exception_ptr> call(F & f, Args &&... args)
+            {
+                try
+                {
+                    f(std::forward<Args>(args)...);
+                    return variant<ready_type, std::exception_ptr>{ ready_type{} };
+                }
+
+                catch (...)
+                {
+                    return variant<ready_type, std::exception_ptr>{ std::current_exception() };
+                }
+            }
+        };
+
+        template<typename T, typename F, typename... Args>
+        auto _invoke_task(F & f, Args &&... args)
+        {
+            return _invoke_task_impl<T>::call(f, std::forward<Args>(args)...);
+        }
+
         template<typename T>
         struct _shared_state : public std::enable_shared_from_this<_shared_state<T>>
         {
             using _replaced = typename _replace_void<T>::type;
-            using then_t = std::conditional_t<
-                std::is_copy_constructible<_replaced>::value,
-                std::vector<_continuation_type>,
-                optional<_continuation_type>
-            >;
 
-            _shared_state(_replaced t) : value{ std::move(t) }
+            _shared_state(_replaced t) : value{ std::move(t) }, continuations{ _completed_tag() }
+            {
+            }
+
+            _shared_state(std::exception_ptr ptr) : value{ ptr }, continuations{ _completed_tag() }
+            {
+            }
+
+            _shared_state() : value{ none }
             {
             }
 
-            _shared_state(std::exception_ptr ptr) : value{ ptr }
+            virtual ~_shared_state()
+            {
+                auto head = continuations.load(std::memory_order_relaxed);
+                while (head && head != _completed_tag())
+                {
+                    auto next = head->next;
+                    head->discard();
+                    head = next;
+                }
+
+                delete _waiter_node.load(std::memory_order_relaxed);
+            }
+
+            variant<_replaced, std::exception_ptr, none_t> value;
+            std::atomic<std::size_t> promise_count{ 0 };
+            std::atomic<std::size_t> shared_count{ 0 };
+            // set once a shared_future refers to this state; the value is never moved out after that
+            std::atomic<bool> pinned{ false };
+
+            std::shared_ptr<executor> scheduler;
+
+            // the stack of continuations to run once the value is set, or _completed_tag() once that has happened
+            // the value (and the scheduler) are published by the exchange that stores the tag
+            std::atomic<_continuation_node *> continuations{ nullptr };
+            std::atomic<bool> has_continuation{ false };
+
+            bool is_ready() const
+            {
+                return continuations.load(std::memory_order_acquire) == _completed_tag();
+            }
+
+            // runs f inline if the state is already completed
+            template<typename F>
+            void attach(F && f)
+            {
+                if (is_ready())
+                {
+                    std::forward<F>(f)();
+                    return;
+                }
+
+                attach(_make_continuation(std::forward<F>(f)));
+            }
+
+            void attach(_continuation_node * node)
+            {
+                if (!_push(node))
+                {
+                    node->run();
+                }
+            }
+
+            // runs the task producing the value of this state; only states created by package() have one
+            virtual void execute(std::shared_ptr<executor>)
+            {
+                assert(!"this state has no task to execute");
+            }
+
+            optional<_replaced> try_get()
+            {
+                if (!is_ready() || value.index() == 2)
+                {
+                    return {};
+                }
+
+                return reaver::make_optional(_get());
+            }
+
+            void wait()
+            {
+                if (is_ready())
+                {
+                    return;
+                }
+
+                _get_waiter().wait();
+            }
+
+            template<typename Clock, typename Duration>
+            bool wait_until(const std::chrono::time_point<Clock, Duration> & time)
+            {
+                if (is_ready())
+                {
+                    return true;
+                }
+
+                return _get_waiter().wait_until(time);
+            }
+
+            _replaced get()
+            {
+                wait();
+                return _get();
+            }
+
+            const _replaced & get_shared()
+            {
+                wait();
+                return reaver::get<0>(_checked_value());
+            }
+
+            void set(_replaced v)
+            {
+                value = std::move(v);
+                _complete();
+            }
+
+            void set(std::exception_ptr ex)
+            {
+                value = std::move(ex);
+                _complete();
+            }
+
+        private:
+            // created by the first blocking wait; later waits, timed out or not, reuse it
+            std::atomic<_waiter *> _waiter_node{ nullptr };
+
+            _waiter & _get_waiter()
+            {
+                auto waiter = _waiter_node.load(std::memory_order_acquire);
+                if (waiter)
+                {
+                    return *waiter;
+                }
+
+                auto created = std::make_unique<_waiter>();
+                if (!_waiter_node.compare_exchange_strong(waiter, created.get(), std::memory_order_acq_rel, std::memory_order_acquire))
+                {
+                    return *waiter;
+                }
+
+                waiter = created.release();
+                attach(static_cast<_continuation_node *>(waiter));
+                return *waiter;
+            }
+
+            bool _push(_continuation_node * node)
+            {
+                auto head = continuations.load(std::memory_order_acquire);
+
+                do
+                {
+                    if (head == _completed_tag())
+                    {
+                        return false;
+                    }
+
+                    node->next = head;
+                } while (!continuations.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_acquire));
+
+                return true;
+            }
+
+            void _complete()
+            {
+                auto head = continuations.exchange(_completed_tag(), std::memory_order_acq_rel);
+                assert(head != _completed_tag());
+
+                // the stack holds the continuations in reverse order of attaching
+                _continuation_node * list = nullptr;
+                while (head)
+                {
+                    auto next = head->next;
+                    head->next = list;
+                    list = head;
+                    head = next;
+                }
+
+                while (list)
+                {
+                    auto next = list->next;
+                    list->run();
+                    list = next;
+                }
+            }
+
+            // rethrows the exception held by the state, if any
+            // a ready state is only empty if its noncopyable value has been moved out through another future
+            auto & _checked_value()
+            {
+                if (value.index() == 2)
+                {
+                    throw future_value_moved{};
+                }
+
+                if (value.index() == 1)
+                {
+                    std::rethrow_exception(reaver::get<1>(value));
+                }
+
+                return value;
+            }
+
+            // the value is moved out only if nothing else can read it later
+            _replaced _get()
+            {
+                return _move_or_copy(_checked_value(), shared_count == 1 && !pinned);
+            }
+
+            template<bool Unwrap = false, typename F>
+            auto _continue(std::shared_ptr<executor> provided_sched, bool run_inline, F && f)
+            {
+                using unwrapped = _unwrap_result<decltype(f(*this)), Unwrap>;
+                using result_type = typename unwrapped::type;
+                using state_type = _continuation_state<result_type, T, std::decay_t<F>, unwrapped::adopt>;
+
+                _reserve_continuation(*this);
+                ++shared_count;
+
+                // GCC is deeply confused when this is directly in the argument list
+                auto self = std::enable_shared_from_this<_shared_state>::shared_from_this();
+
+                auto state = _allocate_state<state_type>(std::move(self), std::move(provided_sched), run_inline, std::forward<F>(f));
+                future<result_type> ret{ state };
+
+                state->keep_alive(state);
+                attach(static_cast<_continuation_node *>(state.get()));
+
+                return ret;
+            }
+
+            template<bool Unwrap, typename F>
+            auto _then(std::shared_ptr<executor> provided_sched, bool run_inline, F && f)
+                -> future<typename _unwrap_result<decltype(_wrap<T>(std::forward<F>(f))(std::declval<_replaced>())), Unwrap>::type>
+            {
+                if (!_is_valid(*this))
+                {
+                    assert(!"what do?");
+                }
+
+                return _continue<Unwrap>(std::move(provided_sched), run_inline, [f = std::forward<F>(f)](_shared_state & parent) mutable {
+                    return _wrap<T>(std::forward<F>(f))(parent._get());
+                });
+            }
+
+        public:
+            // with Unwrap, a future returned by f is adopted by the returned future, instead of becoming its value
+            template<bool Unwrap = false, typename F>
+            auto then(std::shared_ptr<executor> provided_sched, F && f)
+            {
+                return _then<Unwrap>(std::move(provided_sched), false, std::forward<F>(f));
+            }
+
+            // runs the continuation on the thread that completes this state (or on the calling thread, if it's already
+            // completed); falls back to the scheduler of this state when too many continuations are already nested
+            template<bool Unwrap = false, typename F>
+            auto then(inline_type, F && f)
+            {
+                return _then<Unwrap>(nullptr, true, std::forward<F>(f));
+            }
+
+            template<typename F>
+            auto on_error(std::shared_ptr<executor> provided_sched, F && f)
+                -> future<expected<_replaced, decltype(std::forward<F>(f)(std::declval<std::exception_ptr>()))>>
+            {
+                if (!_is_valid(*this))
+                {
+                    assert(!"what do?");
+                }
+
+                auto call_with_void_argument = make_overload_set(
+                    [](auto && callback, auto && lazy_void, typename std::enable_if<std::is_void<decltype(lazy_void())>::value, int>::type = 0) {
+                        lazy_void();
+                        return callback();
+                    },
+
+                    [](auto && callback, auto && lazy_nonvoid, typename std::enable_if<!std::is_void<decltype(lazy_nonvoid())>::value, int>::type = 0) {
+                        return callback(lazy_nonvoid());
+                    }
+                );
+
+                return _continue(std::move(provided_sched), false, [f = std::forward<F>(f), call_with_void_argument](_shared_state & parent) mutable {
+                    try
+                    {
+                        return make_expected_err_type<decltype(std::forward<F>(f)(std::current_exception()))>(parent._get());
+                    }
+
+                    catch (...)
+                    {
+                        return call_with_void_argument(
+                            [&](auto &&... args){ return make_error<_replaced>(std::forward<decltype(args)>(args)...); },
+                            [&](){ return std::forward<F>(f)(std::current_exception()); }
+                        );
+                    }
+                });
+            }
+
+            // calls on_value with the value of this state, or on_error with its exception, inline on the completing thread
+            // both are expected to be cheap; they are skipped if the returned future is gone by the time this state completes
+            template<typename V, typename E>
+            auto observe(V on_value, E on_error)
+            {
+                return _continue(nullptr, true, [on_value = std::move(on_value), on_error = std::move(on_error)](_shared_state & parent) mutable {
+                    if (parent.value.index() == 1)
+                    {
+                        on_error(reaver::get<1>(parent.value));
+                        return;
+                    }
+
+                    on_value(parent._get());
+                });
+            }
+
+            // the scheduler is only read once the continuation runs; it isn't safe to read it before the state is ready
+            template<bool Unwrap = false, typename F>
+            auto then(F && f)
+            {
+                return then<Unwrap>(nullptr, std::forward<F>(f));
+            }
+
+            template<typename F>
+            auto on_error(F && f)
+            {
+                return on_error(nullptr, std::forward<F>(f));
+            }
+        };
+
+        // the state of a future created by package(); the task is stored in place
+        template<typename T, typename F>
+        class _task_state : public _shared_state<T>
+        {
+        public:
+            _task_state(F f)
             {
+                _function.emplace(std::move(f));
             }
 
-            _shared_state() : value{ none }
+            ~_task_state()
             {
+                if (_has_function)
+                {
+                    _function.destroy();
+                }
             }
 
-            std::mutex lock;
-            variant<_replaced, std::exception_ptr, none_t> value;
-            std::atomic<std::size_t> promise_count{ 0 };
-            std::atomic<std::size_t> shared_count{ 0 };
+            virtual void execute(std::shared_ptr<executor> sched) override
+            {
+                assert(_has_function);
 
-            std::shared_ptr<executor> scheduler;
+                this->scheduler = std::move(sched);
 
-            std::mutex continuations_lock;
-            then_t continuations;
+                // nothing is interested in the result anymore
+                if (this->shared_count == 0)
+                {
+                    _function.destroy();
+                    _has_function = false;
+                    return;
+                }
 
-            // TODO: reaver::function
-            optional<class function<T ()>> function;
+                auto result = _invoke_task<T>(_function.reference());
+                _function.destroy();
+                _has_function = false;
 
-            optional<_replaced> try_get()
-            {
-                std::lock_guard<std::mutex> l(lock);
-                return get<0>(fmap(_move_or_copy(value, shared_count == 1 && value.index() != 1), make_overload_set(
-                    [&](_replaced t) {
-                        if (shared_count == 1)
-                        {
-                            value = none;
-                        }
-                        return make_optional(std::move(t));
-                    },
+                fmap(std::move(result), [&](auto && value) {
+                    this->set(std::move(value));
+                    return unit{};
+                });
+            }
 
-                    [&](std::exception_ptr ptr) {
-                        std::rethrow_exception(ptr);
-                        return unit{};
-                    },
+        private:
+            manual_object<F> _function;
+            bool _has_function = true;
+        };
 
-                    [&](none_t) {
-                        return optional<_replaced>();
-                    }
-                )));
+        // what a continuation state pushes to its executor
+        // if it's destroyed without having been run, the promise of the state is broken
+        template<typename State>
+        class _continuation_task
+        {
+        public:
+            _continuation_task(std::shared_ptr<State> state) : _state{ std::move(state) }
+            {
             }
 
-            void set(_replaced v)
+            _continuation_task(_continuation_task &&) noexcept = default;
+
+            ~_continuation_task()
             {
+                if (_state)
                 {
-                    std::unique_lock<std::mutex> l{ lock };
-                    value = std::move(v);
+                    _state->abandon();
                 }
-
-                _invoke_continuations();
             }
 
-            void set(std::exception_ptr ex)
+            void operator()()
             {
-                {
-                    std::unique_lock<std::mutex> l{ lock };
-                    value = std::move(ex);
-                }
-
-                _invoke_continuations();
+                auto state = std::move(_state);
+                state->invoke();
             }
 
         private:
-            void _invoke_continuations()
-            {
-                auto conts = then_t{};
+            std::shared_ptr<State> _state;
+        };
 
-                static_if(std::is_copy_constructible<_replaced>{}, [&](auto) {
-                    // shenanigans
-                    while (
-                        [&]{
-                            std::lock_guard<std::mutex> lock{ continuations_lock };
-                            return !continuations.empty();
-                        }())
-                    {
-                        {
-                            std::lock_guard<std::mutex> lock{ continuations_lock };
-                            using std::swap;
-                            swap(conts, continuations);
-                        }
+        // the state of a future created by then() or on_error()
+        // it stores its callable in place, and is itself the continuation node attached to its parent, so that
+        // a continuation costs a single allocation; it keeps itself alive until it's run, and skips its task if
+        // nothing refers to it by then
+        // with Adopt, the callable returns a future<U>; the node is then attached again, to the state of that future,
+        // and completes this state with its result, so unwrapping doesn't cost any further allocations
+        template<typename U, typename T, typename F, bool Adopt>
+        class _continuation_state : public _shared_state<U>, public _continuation_node
+        {
+            using _result_type = std::conditional_t<Adopt, future<U>, U>;
 
-                        fmap(conts, [&](auto && cont) { cont(); return unit{}; });
-                    }
-                }).static_else([&](auto) {
-                    std::lock_guard<std::mutex> lock{ continuations_lock };
-                    fmap(continuations, [&](auto && cont) { cont(); return unit{}; });
-                });
+        public:
+            _continuation_state(std::shared_ptr<_shared_state<T>> parent, std::shared_ptr<executor> provided, bool run_inline, F f) : _parent{ std::move(parent) }, _provided{ std::move(provided) }, _inline{ run_inline }
+            {
+                _function.emplace(std::move(f));
+            }
 
-                function = none;
-                continuations = then_t{};
+            ~_continuation_state()
+            {
+                if (_parent)
+                {
+                    _function.destroy();
+                }
             }
 
-            _replaced _get()
+            void keep_alive(std::shared_ptr<_continuation_state> self)
             {
-                assert(value.index() != 2);
+                _self = std::move(self);
+            }
 
-                if (value.index() == 1)
+            virtual void run() override
+            {
+                if (_adopted)
                 {
-                    std::rethrow_exception(get<1>(value));
+                    _complete_adopted();
+                    return;
                 }
 
-                auto ret = get<0>(_move_or_copy(value, shared_count == 1 && value.index() != 1));
-                if (shared_count == 1)
+                _continuation_task<_continuation_state> task{ std::move(_self) };
+
+                if (_inline && _try_run_inline(task, inline_executor::default_max_depth))
                 {
-                    value = none;
+                    return;
                 }
-                return ret;
+
+                _executor()->push(std::move(task));
             }
 
-        public:
-            template<typename F>
-            auto then(std::shared_ptr<executor> provided_sched, F && f) -> future<decltype(_wrap<T>(std::forward<F>(f))(std::declval<_replaced>()))>
+            virtual void discard() override
             {
-                std::lock_guard<std::mutex> l{ lock };
+                auto self = std::move(_self);
 
-                if (!_is_valid(*this))
+                if (_adopted)
                 {
-                    assert(!"what do?");
+                    _adopted = none;
+                    this->set(std::make_exception_ptr(broken_promise{}));
+                    return;
                 }
 
-                ++shared_count;
-
-                auto sched = [this, provided = std::move(provided_sched)]() {
-                    if (provided)
-                    {
-                        return provided;
-                    }
-
-                    if (scheduler)
-                    {
-                        return scheduler;
-                    }
+                abandon();
+            }
 
-                    return default_executor();
-                };
+            void invoke()
+            {
+                this->scheduler = _executor();
 
-                return get<0>(fmap(value, make_overload_set(
-                    [&](variant<const _replaced &, std::exception_ptr>) {
-                        auto pair = package([this, f = std::forward<F>(f)]() mutable {
-                            return _wrap<T>(std::forward<F>(f))(_get());
-                        });
+                if (this->shared_count == 0)
+                {
+                    _release();
+                    return;
+                }
 
-                        // GCC is deeply confused when this is directly in the capture list
-                        auto state = std::enable_shared_from_this<_shared_state>::shared_from_this();
+                auto result = _invoke_task<_result_type>(_function.reference(), *_parent);
+                _release();
 
-                        sched()->push([sched, task = std::move(pair.packaged_task), state = std::move(state)](){ task(sched()); });
-                        return std::move(pair.future);
-                    },
+                fmap(std::move(result), [&](auto && value) {
+                    this->_finish(std::integral_constant<bool, Adopt>(), std::move(value));
+                    return unit{};
+                });
+            }
 
-                    [&](none_t) {
-                        auto pair = package([this, f = std::forward<F>(f)]() mutable {
-                            return _wrap<T>(std::forward<F>(f))(_get());
-                        });
+            void abandon()
+            {
+                _release();
+                this->set(std::make_exception_ptr(broken_promise{}));
+            }
 
-                        // GCC is deeply confused when this is directly in the capture list
-                        auto state = std::enable_shared_from_this<_shared_state>::shared_from_this();
+        private:
+            template<typename V>
+            void _finish(std::false_type, V && value)
+            {
+                this->set(std::forward<V>(value));
+            }
 
-                        _add_continuation(*this, [sched, task = std::move(pair.packaged_task), state = std::move(state)]() mutable {
-                            sched()->push([sched, task = std::move(task), state = std::move(state)](){ task(sched()); });
-                        });
-                        return std::move(pair.future);
-                    }
-                )));
+            void _finish(std::true_type, std::exception_ptr ex)
+            {
+                this->set(std::move(ex));
             }
 
-            template<typename F>
-            auto on_error(std::shared_ptr<executor> provided_sched, F && f)
-                -> future<expected<_replaced, decltype(std::forward<F>(f)(std::declval<std::exception_ptr>()))>>
+            void _finish(std::true_type, future<U> inner)
             {
-                std::lock_guard<std::mutex> l{ lock };
+                assert(inner._state);
 
-                if (!_is_valid(*this))
+                try
                 {
-                    assert(!"what do?");
+                    _reserve_continuation(*inner._state);
                 }
 
-                ++shared_count;
-
-                auto sched = [this, provided = std::move(provided_sched)]() {
-                    if (provided)
-                    {
-                        return provided;
-                    }
-
-                    if (scheduler)
-                    {
-                        return scheduler;
-                    }
-
-                    return default_executor();
-                };
-
-                auto call_with_void_argument = make_overload_set(
-                    [](auto && callback, auto && lazy_void, typename std::enable_if<std::is_void<decltype(lazy_void())>::value, int>::type = 0) {
-                        lazy_void();
-                        return callback();
-                    },
-
-                    [](auto && callback, auto && lazy_nonvoid, typename std::enable_if<!std::is_void<decltype(lazy_nonvoid())>::value, int>::type = 0) {
-                        return callback(lazy_nonvoid());
-                    }
-                );
-
-                return get<0>(fmap(value, make_overload_set(
-                    [&](variant<const _replaced &, std::exception_ptr>) {
-                        auto pair = package([this, f = std::forward<F>(f), call_with_void_argument]() mutable {
-                            try
-                            {
-                                return make_expected_err_type<decltype(std::forward<F>(f)(std::current_exception()))>(_get());
-                            }
+                catch (...)
+                {
+                    this->set(std::current_exception());
+                    return;
+                }
 
-                            catch (...)
-                            {
-                                return call_with_void_argument(
-                                    [&](auto &&... args){ return make_error<_replaced>(std::forward<decltype(args)>(args)...); },
-                                    [&](){ return std::forward<F>(f)(std::current_exception()); }
-                                );
-                            }
-                        });
+                _adopted = std::move(inner._state);
+                _self = std::static_pointer_cast<_continuation_state>(std::enable_shared_from_this<_shared_state<U>>::shared_from_this());
+                (*_adopted)->attach(static_cast<_continuation_node *>(this));
+            }
 
-                        // GCC is deeply confused when this is directly in the capture list
-                        auto state = std::enable_shared_from_this<_shared_state>::shared_from_this();
+            // runs inline on the thread that completes the adopted state; it only moves the result over
+            void _complete_adopted()
+            {
+                auto self = std::move(_self);
+                auto adopted = std::move(*_adopted);
+                _adopted = none;
 
-                        sched()->push([sched, task = std::move(pair.packaged_task), state = std::move(state)](){ task(sched()); });
-                        return std::move(pair.future);
-                    },
+                if (adopted->value.index() == 1)
+                {
+                    this->set(reaver::get<1>(adopted->value));
+                    return;
+                }
 
-                    [&](none_t) {
-                        auto pair = package([this, f = std::forward<F>(f), call_with_void_argument]() mutable {
-                            try
-                            {
-                                return make_expected_err_type<decltype(std::forward<F>(f)(std::current_exception()))>(_get());
-                            }
+                this->set(adopted->get());
+            }
 
-                            catch (...)
-                            {
-                                return call_with_void_argument(
-                                    [&](auto &&... args){ return make_error<_replaced>(std::forward<decltype(args)>(args)...); },
-                                    [&](){ return std::forward<F>(f)(std::current_exception()); }
-                                );
-                            }
-                        });
+            std::shared_ptr<executor> _executor() const
+            {
+                if (_provided)
+                {
+                    return _provided;
+                }
 
-                        // GCC is deeply confused when this is directly in the capture list
-                        auto state = std::enable_shared_from_this<_shared_state>::shared_from_this();
+                if (_parent->scheduler)
+                {
+                    return _parent->scheduler;
+                }
 
-                        _add_continuation(*this, [sched, task = std::move(pair.packaged_task), state = std::move(state)]() mutable {
-                            sched()->push([sched, task = std::move(task), state = std::move(state)](){ task(sched()); });
-                        });
-                        return std::move(pair.future);
-                    }
-                )));
+                return default_executor();
             }
 
-            template<typename F>
-            auto then(F && f)
+            void _release()
             {
-                return then(scheduler, std::forward<F>(f));
+                _function.destroy();
+                _parent = nullptr;
             }
 
-            template<typename F>
-            auto on_error(F && f)
-            {
-                return on_error(scheduler, std::forward<F>(f));
-            }
+            std::shared_ptr<_shared_state<T>> _parent;
+            std::shared_ptr<executor> _provided;
+            std::shared_ptr<_continuation_state> _self;
+            bool _inline;
+            manual_object<F> _function;
+            optional<_future_ptr<U>> _adopted;
         };
 
         template<typename T>
@@ -473,14 +1076,10 @@ namespace reaver { inline namespace _v1
         template<typename T>
         void _remove_promise(_shared_state<T> & state)
         {
-            if (--state.promise_count == 0)
+            // no promise is left to race with, so this can't be a second set()
+            if (--state.promise_count == 0 && _is_pending(state))
             {
-                std::lock_guard<std::mutex> lock{ state.lock };
-                if (_is_pending(state))
-                {
-                    state.function = none;
-                    state.value = std::make_exception_ptr(broken_promise{});
-                }
+                state.set(std::make_exception_ptr(broken_promise{}));
             }
         }
 
@@ -547,12 +1146,12 @@ namespace reaver { inline namespace _v1
                 return _ptr != nullptr;
             }
 
-            auto operator*()
+            auto & operator*()
             {
                 return *_ptr;
             }
 
-            auto operator*() const
+            auto & operator*() const
             {
                 return *_ptr;
             }
@@ -662,51 +1261,21 @@ namespace reaver { inline namespace _v1
                 return;
             }
 
-            state->scheduler = std::move(sched);
-
-            try
-            {
-                auto && value = (*state->function)();
-                state->set(std::move(value));
-            }
-            catch (...)
-            {
-                state->set(std::current_exception());
-            }
+            state->execute(std::move(sched));
         }
 
     private:
         _detail::_promise_ptr<T> _state;
     };
 
-    template<>
-    inline void packaged_task<void>::operator()(std::shared_ptr<executor> sched) const
-    {
-        auto state = _state.lock();
-
-        if (!state)
-        {
-            return;
-        }
-
-        state->scheduler = std::move(sched);
-
-        try
-        {
-            (*state->function)();
-            state->set(ready);
-        }
-        catch (...)
-        {
-            state->set(std::current_exception());
-        }
-    }
-
     template<typename T>
     future<T> join(std::shared_ptr<executor>, future<future<T>>);
 
     namespace _detail
     {
+        template<typename T, typename V, typename E>
+        future<> _observe(const future<T> & input, V on_value, E on_error);
+
         template<typename F, typename U>
         static auto _unwrap(F, future<U> fut)
         {
@@ -732,22 +1301,39 @@ namespace reaver { inline namespace _v1
     public:
         using value_type = T;
 
+#ifdef __cpp_impl_coroutine
+        // lets coroutines return futures; include coroutine.h to use it
+        using promise_type = _detail::_coroutine_promise<T>;
+#endif
+
         template<typename F>
         friend auto package(F && f) -> future_package_pair<decltype(std::forward<F>(f)())>;
 
         template<typename U>
         friend future_promise_pair<U> make_promise();
 
+        template<typename U>
+        friend struct _detail::_shared_state;
+
+        template<typename U, typename V, typename E>
+        friend future<> _detail::_observe(const future<U> &, V, E);
+
+        template<typename U>
+        friend class shared_future;
+
+        template<typename U, typename V, typename F, bool Adopt>
+        friend class _detail::_continuation_state;
+
         future(const future &) = default;
         future(future &&) = default;
         future & operator=(const future &) = default;
         future & operator=(future &&) = default;
 
-        explicit future(typename _detail::_replace_void<T>::type value) : future{ std::make_shared<_detail::_shared_state<T>>(std::move(value)) }
+        explicit future(typename _detail::_replace_void<T>::type value) : future{ _detail::_allocate_state<_detail::_shared_state<T>>(std::move(value)) }
         {
         }
 
-        explicit future(std::exception_ptr ex) : future{ std::make_shared<_detail::_shared_state<T>>(std::move(ex)) }
+        explicit future(std::exception_ptr ex) : future{ _detail::_allocate_state<_detail::_shared_state<T>>(std::move(ex)) }
         {
         }
 
@@ -756,6 +1342,53 @@ namespace reaver { inline namespace _v1
             return _state->try_get();
         };
 
+        // blocks until the future is ready; if it holds a value, it's moved out if this is the only reference to it
+        T get() &
+        {
+            return static_cast<T>(_state->get());
+        }
+
+        T get() &&
+        {
+            return std::move(*this).take();
+        }
+
+        // blocks until the future is ready and moves its value out, without copying it, unless other futures or a
+        // shared_future refer to the same state; the value is copied then, so that they can still read it
+        // noncopyable values are always moved; getting them through another future afterwards throws future_value_moved
+        T take() &&
+        {
+            auto state = std::move(_state);
+            return static_cast<T>(state->get());
+        }
+
+        shared_future<T> share() &&
+        {
+            return shared_future<T>{ std::move(*this) };
+        }
+
+        bool is_ready() const
+        {
+            return _state->is_ready();
+        }
+
+        void wait() const
+        {
+            _state->wait();
+        }
+
+        template<typename Rep, typename Period>
+        bool wait_for(const std::chrono::duration<Rep, Period> & duration) const
+        {
+            return _state->wait_until(std::chrono::steady_clock::now() + duration);
+        }
+
+        template<typename Clock, typename Duration>
+        bool wait_until(const std::chrono::time_point<Clock, Duration> & time) const
+        {
+            return _state->wait_until(time);
+        }
+
         template<typename F>
         auto then(do_not_unwrap_type, std::shared_ptr<executor> sched, F && f)
         {
@@ -770,7 +1403,12 @@ namespace reaver { inline namespace _v1
         template<typename F>
         auto then(std::shared_ptr<executor> sched, F && f)
         {
-            return _detail::_unwrap([sched = sched]{ return sched; }, then(do_not_unwrap, sched, std::forward<F>(f)));
+            if (!_state)
+            {
+                assert(!"handle this somehow (new exception type!)");
+            }
+
+            return _state->template then<true>(std::move(sched), std::forward<F>(f));
         }
 
         template<typename F>
@@ -804,7 +1442,54 @@ namespace reaver { inline namespace _v1
         template<typename F>
         auto then(F && f)
         {
-            return _detail::_unwrap([]{ return default_executor(); }, then(do_not_unwrap, std::forward<F>(f)));
+            if (!_state)
+            {
+                assert(!"handle this somehow (new exception type!)");
+            }
+
+            return _state->template then<true>(std::forward<F>(f));
+        }
+
+        // the continuation is skipped, and the returned future fails with cancelled, if token is cancelled before it starts
+        template<typename F>
+        auto then(cancellation_token token, std::shared_ptr<executor> sched, F && f)
+        {
+            return then(std::move(sched), with_cancellation(std::move(token), std::forward<F>(f)));
+        }
+
+        template<typename F>
+        auto then(cancellation_token token, F && f)
+        {
+            return then(with_cancellation(std::move(token), std::forward<F>(f)));
+        }
+
+        template<typename F>
+        auto then(do_not_unwrap_type, inline_type, F && f)
+        {
+            if (!_state)
+            {
+                assert(!"handle this somehow (new exception type!)");
+            }
+
+            return _state->then(inline_, std::forward<F>(f));
+        }
+
+        template<typename F>
+        auto then(inline_type, F && f)
+        {
+            if (!_state)
+            {
+                assert(!"handle this somehow (new exception type!)");
+            }
+
+            return _state->template then<true>(inline_, std::forward<F>(f));
+        }
+
+        // for continuations too cheap to be worth a trip through an executor
+        template<typename F>
+        auto then_inline(F && f)
+        {
+            return then(inline_, std::forward<F>(f));
         }
 
         template<typename F>
@@ -815,30 +1500,95 @@ namespace reaver { inline namespace _v1
                 assert(!"handle this somehow (new exception type!)");
             }
 
-            return _state->on_error(std::forward<F>(f));
+            return _state->on_error(std::forward<F>(f));
+        }
+
+        template<typename F>
+        auto on_error(F && f)
+        {
+            return _detail::_unwrap([]{ return default_executor(); }, on_error(do_not_unwrap, std::forward<F>(f)));
+        }
+
+        void detach()
+        {
+            then([keep = _state](auto &&... args){});
+        }
+
+        // the scheduler that ran the task that produced this future; null until the future is ready
+        auto scheduler() const
+        {
+            return _state->is_ready() ? _state->scheduler : std::shared_ptr<executor>{};
+        }
+
+    private:
+        _detail::_future_ptr<T> _state;
+    };
+
+    // a read-only handle to the result of a future; the value is handed out by reference, and so is never copied or moved
+    // out of the state, no matter how many shared_futures refer to it
+    template<typename T>
+    class shared_future
+    {
+    public:
+        using value_type = T;
+
+        shared_future(future<T> f) : _state{ std::move(f._state) }
+        {
+            assert(_state);
+            _state->pinned = true;
+        }
+
+        shared_future(const shared_future &) = default;
+        shared_future(shared_future &&) = default;
+        shared_future & operator=(const shared_future &) = default;
+        shared_future & operator=(shared_future &&) = default;
+
+        // blocks until the future is ready; rethrows the exception it holds, if any
+        std::add_lvalue_reference_t<const T> get() const
+        {
+            return static_cast<std::add_lvalue_reference_t<const T>>(_state->get_shared());
+        }
+
+        bool is_ready() const
+        {
+            return _state->is_ready();
         }
 
-        template<typename F>
-        auto on_error(F && f)
+        void wait() const
         {
-            return _detail::_unwrap([]{ return default_executor(); }, on_error(do_not_unwrap, std::forward<F>(f)));
+            _state->wait();
         }
 
-        void detach()
+        template<typename Rep, typename Period>
+        bool wait_for(const std::chrono::duration<Rep, Period> & duration) const
         {
-            then([keep = _state](auto &&... args){});
+            return _state->wait_until(std::chrono::steady_clock::now() + duration);
         }
 
-        auto scheduler() const
+        template<typename Clock, typename Duration>
+        bool wait_until(const std::chrono::time_point<Clock, Duration> & time) const
         {
-            std::lock_guard<std::mutex> lock{ _state->lock };
-            return _state->scheduler;
+            return _state->wait_until(time);
         }
 
     private:
         _detail::_future_ptr<T> _state;
     };
 
+    namespace _detail
+    {
+        template<typename T, typename V, typename E>
+        future<> _observe(const future<T> & input, V on_value, E on_error)
+        {
+            if (!input._state)
+            {
+                assert(!"handle this somehow (new exception type!)");
+            }
+
+            return input._state->observe(std::move(on_value), std::move(on_error));
+        }
+    }
+
     template<typename T>
     auto make_ready_future(T && t)
     {
@@ -868,9 +1618,7 @@ namespace reaver { inline namespace _v1
     {
         using T = decltype(std::forward<F>(f)());
 
-        auto state = std::make_shared<_detail::_shared_state<T>>();
-        state->function = std::forward<F>(f);
-
+        std::shared_ptr<_detail::_shared_state<T>> state = _detail::_allocate_state<_detail::_task_state<T, std::decay_t<F>>>(std::forward<F>(f));
         return future_package_pair<T>{ { state }, { std::move(state) } };
     };
 
@@ -928,23 +1676,16 @@ namespace reaver { inline namespace _v1
     template<typename T>
     future_promise_pair<T> make_promise()
     {
-        auto state = std::make_shared<_detail::_shared_state<T>>();
-        state->function = []() -> T { assert(!"I need to handle this somehow"); };
-
+        auto state = _detail::_allocate_state<_detail::_shared_state<T>>();
         return { { state }, { (state) } };
     }
 
     template<typename T>
     future<T> join(std::shared_ptr<executor> sched, future<future<T>> fut)
     {
-        auto pair = make_promise<T>();
-        fut.then(sched, [promise = std::move(pair.promise), sched](auto && inner) {
-            inner.then(std::move(sched), [promise = std::move(promise)](typename _detail::_replace_void<T>::type value = {}) {
-                promise.set(std::move(value));
-            }).detach();
-        }).detach();
-
-        return std::move(pair.future);
+        return fut.then(std::move(sched), [](future<T> inner) {
+            return inner;
+        });
     }
 
     template<typename T>
@@ -969,6 +1710,54 @@ namespace reaver { inline namespace _v1
 
         template<std::size_t N>
         using _int = std::integral_constant<std::size_t, N>;
+
+        // the references a combinator (like when_all) holds on its inputs and on the continuations attached to them
+        // they are only needed until the result is decided, and are dropped by whichever comes last: the end of
+        // attaching the continuations, or the decision; dropping the continuations means the ones still pending
+        // are skipped when their inputs complete
+        template<typename Inputs>
+        class _fan_in_references
+        {
+        public:
+            void attached()
+            {
+                _release([&]{ _attached = true; });
+            }
+
+            void decided()
+            {
+                _release([&]{ _decided = true; });
+            }
+
+            Inputs inputs;
+            std::vector<future<>> keep_alive;
+
+        private:
+            template<typename F>
+            void _release(F && mark)
+            {
+                Inputs released_inputs;
+                std::vector<future<>> released_keep_alive;
+
+                {
+                    std::lock_guard<std::mutex> lock{ _lock };
+                    mark();
+
+                    if (!_attached || !_decided)
+                    {
+                        return;
+                    }
+
+                    using std::swap;
+                    swap(released_inputs, inputs);
+                    swap(released_keep_alive, keep_alive);
+                }
+            }
+
+            std::mutex _lock;
+            bool _attached = false;
+            bool _decided = false;
+        };
     }
 
     enum class exception_policy
@@ -999,14 +1788,27 @@ namespace reaver { inline namespace _v1
         {
             buffer_type buffer;
             std::atomic<std::size_t> remaining{ sizeof...(Ts) };
+            // set by whoever schedules the task; only one of the handlers gets to do that
+            std::atomic<bool> finished{ false };
             optional<packaged_task<return_type>> task;
-            std::vector<future<>> futures;
+            _detail::_fan_in_references<unit> references;
             exception_list exceptions;
+            std::exception_ptr failure;
         };
 
-        auto state = std::make_shared<internal_state>();
+        // the task keeps the state alive until it runs; the handlers only hold weak references, so that the buffer
+        // is freed once the result is decided, instead of waiting for the slowest input to complete
+        // not make_shared, since the weak references would keep its whole block allocated
+        std::shared_ptr<internal_state> state{ new internal_state };
+        std::weak_ptr<internal_state> weak_state = state;
+
         auto pair = package([state](){
-            state->futures = {};
+            state->references.decided();
+
+            if (state->failure)
+            {
+                std::rethrow_exception(state->failure);
+            }
 
             if (state->exceptions.size())
             {
@@ -1017,37 +1819,67 @@ namespace reaver { inline namespace _v1
         });
         state->task = std::move(pair.packaged_task);
 
-        auto void_handler = [state, sched]() {
-            if (--state->remaining == 0)
+        auto finish = [](auto & state, auto & sched) {
+            if (!state->finished.exchange(true))
             {
                 sched->push([sched, task = std::move(*state->task)](){ task(sched); });
             }
         };
 
+        auto void_handler = [weak_state, sched, finish]() {
+            auto state = weak_state.lock();
+            if (!state)
+            {
+                return;
+            }
+
+            if (--state->remaining == 0)
+            {
+                finish(state, sched);
+            }
+        };
+
         auto nonvoid_handler = [&](auto index) {
-            return [state, sched](auto value) {
+            return [weak_state, sched, finish](auto value) {
+                auto state = weak_state.lock();
+                if (!state)
+                {
+                    return;
+                }
+
                 get<decltype(index)::value>(state->buffer) = std::move(value);
 
                 if (--state->remaining == 0)
                 {
-                    sched->push([sched, task = std::move(*state->task)](){ task(sched); });
+                    finish(state, sched);
                 }
             };
         };
 
-        auto on_error = [state, sched, policy](auto exception_ptr) {
+        auto on_error = [weak_state, sched, policy, finish](auto exception_ptr) {
+            auto state = weak_state.lock();
+            if (!state)
+            {
+                return;
+            }
+
             switch (policy)
             {
                 case exception_policy::aggregate:
                     state->exceptions.push_back(exception_ptr);
                     if (--state->remaining == 0)
                     {
-                        sched->push([sched, task = std::move(*state->task)](){ task(sched); });
+                        finish(state, sched);
                     }
                     break;
 
                 case exception_policy::abort_on_first_failure:
-                    assert(!"implement this shit");
+                    if (!state->finished.exchange(true))
+                    {
+                        state->failure = exception_ptr;
+                        sched->push([sched, task = std::move(*state->task)](){ task(sched); });
+                        state->references.decided();
+                    }
                     break;
             }
         };
@@ -1058,8 +1890,8 @@ namespace reaver { inline namespace _v1
             [&](auto self, auto index, future<void> & vf, auto &... rest) {
                 auto scheduler = vf.scheduler() ? vf.scheduler() : sched;
 
-                state->futures.push_back(vf.then(std::move(scheduler), void_handler));
-                state->futures.push_back(vf.on_error(std::move(scheduler), on_error).then([](auto){}));
+                state->references.keep_alive.push_back(vf.then(std::move(scheduler), void_handler));
+                state->references.keep_alive.push_back(vf.on_error(std::move(scheduler), on_error).then([](auto){}));
 
                 self(self, _detail::_int<index>(), rest...);
             },
@@ -1067,14 +1899,15 @@ namespace reaver { inline namespace _v1
             [&](auto self, auto index, auto & nvf, auto &... rest) {
                 auto scheduler = nvf.scheduler() ? nvf.scheduler() : sched;
 
-                state->futures.push_back(nvf.then(std::move(scheduler), nonvoid_handler(index)));
-                state->futures.push_back(nvf.on_error(std::move(scheduler), on_error).then([](auto){}));
+                state->references.keep_alive.push_back(nvf.then(std::move(scheduler), nonvoid_handler(index)));
+                state->references.keep_alive.push_back(nvf.on_error(std::move(scheduler), on_error).then([](auto){}));
 
                 self(self, _detail::_int<index + 1>(), rest...);
             }
         );
 
         handler(handler, _detail::_int<0>(), futures...);
+        state->references.attached();
 
         return std::move(pair.future);
     }
@@ -1122,13 +1955,46 @@ namespace reaver { inline namespace _v1
             return future<task_type>(value_type{});
         }
 
+        using slot_type = typename _detail::_replace_void<T>::type;
+
+        // a single continuation per input, writing straight into a preallocated slot
         struct internal_state
         {
+            internal_state(std::size_t size) : remaining{ size }, results(std::is_void<T>::value ? 0 : size), failures(size)
+            {
+            }
+
+            // rethrows the first failure with abort_on_first_failure, or the list of the failures with aggregate
+            void rethrow_failures()
+            {
+                if (failure)
+                {
+                    std::rethrow_exception(failure);
+                }
+
+                exception_list exceptions;
+                for (auto && exception : failures)
+                {
+                    if (exception)
+                    {
+                        exceptions.push_back(exception);
+                    }
+                }
+
+                if (exceptions.size())
+                {
+                    throw std::move(exceptions);
+                }
+            }
+
             std::atomic<std::size_t> remaining;
+            std::atomic<bool> finished{ false };
+            std::vector<optional<slot_type>> results;
+            // with aggregate, each input stores its exception in its own slot, so failing inputs never share a write
+            std::vector<std::exception_ptr> failures;
             optional<packaged_task<task_type>> task;
-            std::vector<future<T>> futures;
-            std::vector<future<>> keep_alive;
-            exception_list exceptions;
+            _detail::_fan_in_references<unit> references;
+            std::exception_ptr failure;
         };
 
         if (!sched)
@@ -1136,74 +2002,105 @@ namespace reaver { inline namespace _v1
             assert(!"what do");
         }
 
-        auto state = std::make_shared<internal_state>();
-        state->remaining = futures.size();
+        // see the variadic when_all for why the observers only hold weak references to the state
+        std::shared_ptr<internal_state> state{ new internal_state{ futures.size() } };
+        std::weak_ptr<internal_state> weak_state = state;
 
         auto to_package = make_overload_set(
-            [&](auto) {
+            [&](auto type) {
                 return [state]() {
-                    if (state->exceptions.size())
+                    state->references.decided();
+                    state->rethrow_failures();
+
+                    std::vector<typename decltype(type)::type> ret;
+                    ret.reserve(state->results.size());
+                    for (auto && result : state->results)
                     {
-                        throw std::move(state->exceptions);
+                        ret.push_back(std::move(*result));
                     }
 
-                    auto ret = fmap(state->futures, [](auto & future){ return *future.try_get(); });
-                    state->futures = {};
+                    state->results = {};
                     return ret;
                 };
             },
 
             [&](id<void>) {
                 return [state]() {
-                    state->futures = {};
-
-                    if (state->exceptions.size())
-                    {
-                        throw std::move(state->exceptions);
-                    }
+                    state->references.decided();
+                    state->rethrow_failures();
                 };
             }
         );
 
         auto pair = package(to_package(id<T>()));
         state->task = std::move(pair.packaged_task);
-        state->futures = futures;
-        state->keep_alive.reserve(futures.size());
 
-        fmap(state->futures, [&](auto & future) {
-            auto scheduler = future.scheduler() ? future.scheduler() : sched;
+        auto finish = [](auto & state, auto & sched) {
+            if (!state->finished.exchange(true))
+            {
+                sched->push([sched, task = std::move(*state->task)](){ task(sched); });
+            }
+        };
 
-            state->keep_alive.push_back(future.then(std::move(scheduler), [sched, state](auto &&... arg) {
-                // GCC fails to understand that the argument pack can be empty...
-                // ...unless it has a name
-                // WTF.
-                swallow{ arg... };
+        auto store = make_overload_set(
+            [](auto & results, std::size_t index, auto value) {
+                results[index] = std::move(value);
+            },
 
-                if (--state->remaining == 0)
-                {
-                    sched->push([sched, task = std::move(*state->task)](){ task(sched); });
-                }
-            }));
+            [](auto &, std::size_t, ready_type) {}
+        );
 
-            state->keep_alive.push_back(future.on_error([state, sched, policy](auto exception_ptr) {
-                switch (policy)
-                {
-                    case exception_policy::aggregate:
-                        state->exceptions.push_back(exception_ptr);
-                        if (--state->remaining == 0)
-                        {
-                            sched->push([sched, task = std::move(*state->task)](){ task(sched); });
-                        }
-                        break;
+        state->references.keep_alive.reserve(futures.size());
+
+        for (std::size_t i = 0; i < futures.size(); ++i)
+        {
+            state->references.keep_alive.push_back(_detail::_observe(futures[i],
+                [weak_state, sched, finish, store, i](auto value) {
+                    auto state = weak_state.lock();
+                    if (!state)
+                    {
+                        return;
+                    }
+
+                    store(state->results, i, std::move(value));
+
+                    if (--state->remaining == 0)
+                    {
+                        finish(state, sched);
+                    }
+                },
+
+                [weak_state, sched, policy, finish, i](std::exception_ptr exception) {
+                    auto state = weak_state.lock();
+                    if (!state)
+                    {
+                        return;
+                    }
+
+                    switch (policy)
+                    {
+                        case exception_policy::aggregate:
+                            state->failures[i] = exception;
+                            if (--state->remaining == 0)
+                            {
+                                finish(state, sched);
+                            }
+                            break;
 
-                    case exception_policy::abort_on_first_failure:
-                        assert(!"implement this shit");
-                        break;
+                        case exception_policy::abort_on_first_failure:
+                            if (!state->finished.exchange(true))
+                            {
+                                state->failure = exception;
+                                sched->push([sched, task = std::move(*state->task)](){ task(sched); });
+                                state->references.decided();
+                            }
+                            break;
+                    }
                 }
-            }).then([](auto){}));
+            ));
+        }
 
-            return unit{};
-        });
+        state->references.attached();
 
         return std::move(pair.future);
     }
@@ -1226,6 +2123,216 @@ namespace reaver { inline namespace _v1
         return when_all(std::move(sched), exception_policy::aggregate, futures);
     }
 
+    namespace _detail
+    {
+        // what when_any and when_n resolve with for each winning input: its index, and its value, if it has one
+        template<typename T>
+        struct _indexed
+        {
+            using type = std::pair<std::size_t, T>;
+
+            static type make(std::size_t index, T value)
+            {
+                return { index, std::move(value) };
+            }
+        };
+
+        template<>
+        struct _indexed<void>
+        {
+            using type = std::size_t;
+
+            static type make(std::size_t index, ready_type)
+            {
+                return index;
+            }
+        };
+
+        // resolves with the first count inputs to succeed, in the order of completion, and fails with the list of
+        // failures as soon as count successes become impossible; the inputs that lose are not waited for
+        template<typename T, typename F>
+        auto _when_n(std::shared_ptr<executor> sched, std::size_t count, const std::vector<future<T>> & futures, F finalize)
+        {
+            using indexed_type = typename _indexed<T>::type;
+            using result_type = decltype(finalize(std::declval<std::vector<indexed_type>>()));
+
+            if (!sched)
+            {
+                assert(!"what do");
+            }
+
+            if (futures.size() < count)
+            {
+                return make_exceptional_future<result_type>(exception_list{});
+            }
+
+            struct internal_state
+            {
+                internal_state(std::size_t count, std::size_t size) : count{ count }, tolerated{ size - count }, results(count), failures(size - count + 1)
+                {
+                }
+
+                std::size_t count;
+                std::size_t tolerated;
+
+                // slots are claimed in the order of completion; the one to fill the last slot wins
+                std::vector<optional<indexed_type>> results;
+                std::atomic<std::size_t> claimed{ 0 };
+                std::atomic<std::size_t> written{ 0 };
+
+                // the same for failures; the one to fill the last slot makes success impossible, and the failures
+                // past that are dropped, so that they are never written while the task reads the slots
+                std::vector<std::exception_ptr> failures;
+                std::atomic<std::size_t> failed{ 0 };
+                std::atomic<std::size_t> failures_written{ 0 };
+
+                std::atomic<bool> finished{ false };
+                bool succeeded = false;
+                optional<packaged_task<result_type>> task;
+                _fan_in_references<unit> references;
+            };
+
+            // see the variadic when_all for why the observers only hold weak references to the state
+            std::shared_ptr<internal_state> state{ new internal_state{ count, futures.size() } };
+            std::weak_ptr<internal_state> weak_state = state;
+
+            auto pair = package([state, finalize = std::move(finalize)]() mutable {
+                if (!state->succeeded)
+                {
+                    exception_list exceptions;
+                    for (auto && failure : state->failures)
+                    {
+                        exceptions.push_back(failure);
+                    }
+
+                    throw std::move(exceptions);
+                }
+
+                std::vector<indexed_type> ret;
+                ret.reserve(state->count);
+                for (auto && result : state->results)
+                {
+                    ret.push_back(std::move(*result));
+                }
+
+                return finalize(std::move(ret));
+            });
+            state->task = std::move(pair.packaged_task);
+
+            auto finish = [](auto & state, auto & sched, bool succeeded) {
+                if (!state->finished.exchange(true))
+                {
+                    state->succeeded = succeeded;
+                    sched->push([sched, task = std::move(*state->task)](){ task(sched); });
+                    state->references.decided();
+                }
+            };
+
+            if (count == 0)
+            {
+                finish(state, sched, true);
+            }
+
+            state->references.keep_alive.reserve(futures.size());
+
+            for (std::size_t i = 0; i < futures.size(); ++i)
+            {
+                state->references.keep_alive.push_back(_observe(futures[i],
+                    [weak_state, sched, finish, i](auto value) {
+                        auto state = weak_state.lock();
+                        if (!state)
+                        {
+                            return;
+                        }
+
+                        auto slot = state->claimed++;
+                        if (slot >= state->count)
+                        {
+                            return;
+                        }
+
+                        state->results[slot] = _indexed<T>::make(i, std::move(value));
+
+                        if (++state->written == state->count)
+                        {
+                            finish(state, sched, true);
+                        }
+                    },
+
+                    [weak_state, sched, finish](std::exception_ptr exception) {
+                        auto state = weak_state.lock();
+                        if (!state)
+                        {
+                            return;
+                        }
+
+                        auto slot = state->failed++;
+                        if (slot > state->tolerated)
+                        {
+                            return;
+                        }
+
+                        state->failures[slot] = exception;
+
+                        if (++state->failures_written == state->tolerated + 1)
+                        {
+                            finish(state, sched, false);
+                        }
+                    }
+                ));
+            }
+
+            state->references.attached();
+
+            return std::move(pair.future);
+        }
+    }
+
+    // resolves with the index and the value of the first input to succeed (or just the index, for void futures)
+    // fails with the list of all the failures if none of the inputs succeed
+    template<typename T>
+    auto when_any(std::shared_ptr<executor> sched, const std::vector<future<T>> & futures)
+    {
+        return _detail::_when_n(std::move(sched), 1, futures, [](auto results) {
+            return std::move(results.front());
+        });
+    }
+
+    template<typename T>
+    auto when_any(const std::vector<future<T>> & futures)
+    {
+        return when_any(default_executor(), futures);
+    }
+
+    template<typename T, typename... Ts>
+    auto when_any(std::shared_ptr<executor> sched, future<T> first, future<Ts>... rest)
+    {
+        static_assert(all_of<std::is_same<T, Ts>::value...>::value, "when_any requires all the futures to be of the same type.");
+        return when_any(std::move(sched), std::vector<future<T>>{ std::move(first), std::move(rest)... });
+    }
+
+    template<typename T, typename... Ts>
+    auto when_any(future<T> first, future<Ts>... rest)
+    {
+        return when_any(default_executor(), std::move(first), std::move(rest)...);
+    }
+
+    // resolves with the indices and the values of the first count inputs to succeed, in the order of completion
+    // fails with the list of the failures as soon as there aren't enough inputs left to succeed
+    template<typename T>
+    auto when_n(std::shared_ptr<executor> sched, std::size_t count, const std::vector<future<T>> & futures)
+    {
+        return _detail::_when_n(std::move(sched), count, futures, [](auto results) {
+            return results;
+        });
+    }
+
+    template<typename T>
+    auto when_n(std::size_t count, const std::vector<future<T>> & futures)
+    {
+        return when_n(default_executor(), count, futures);
+    }
+
     namespace _detail
     {
         // I wish C++ just allowed generalized lambda captures on packs
@@ -1249,10 +2356,34 @@ namespace reaver { inline namespace _v1
         return _detail::_async_impl(std::make_index_sequence<sizeof...(Args)>(), std::move(scheduler), std::forward<F>(f), std::forward<Args>(args)...);
     }
 
-    template<typename F, typename... Args>
+    namespace _detail
+    {
+        // keeps the overloads of async() taking the callable first from catching schedulers and cancellation tokens
+        template<typename F>
+        struct _is_async_callable : std::integral_constant<bool,
+            !std::is_convertible<F, std::shared_ptr<executor>>::value && !std::is_same<std::decay_t<F>, cancellation_token>::value>
+        {
+        };
+    }
+
+    template<typename F, typename... Args, typename std::enable_if<_detail::_is_async_callable<F>::value, int>::type = 0>
     auto async(F && f, Args &&... args)
     {
         return _detail::_async_impl(std::make_index_sequence<sizeof...(Args)>(), default_executor(), std::forward<F>(f), std::forward<Args>(args)...);
     }
+
+    // the task is skipped, and the returned future fails with cancelled, if token is cancelled before it starts
+    template<typename F, typename... Args>
+    auto async(cancellation_token token, std::shared_ptr<executor> scheduler, F && f, Args &&... args)
+    {
+        return async(std::move(scheduler), with_cancellation(std::move(token), std::forward<F>(f)), std::forward<Args>(args)...);
+    }
+
+    template<typename F, typename... Args, typename std::enable_if<_detail::_is_async_callable<F>::value, int>::type = 0>
+    auto async(cancellation_token token, F && f, Args &&... args)
+    {
+        return async(default_executor(), with_cancellation(std::move(token), std::forward<F>(f)), std::forward<Args>(args)...);
+    }
 }}
 
+#include "thread_pool_futures.h"
@@ -0,0 +1,99 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+#pragma once
+
+#include <memory>
+#include <cstddef>
+
+#include "executor.h"
+#include "default_executor.h"
+#include "tls.h"
+
+namespace reaver { inline namespace _v1
+{
+    namespace _detail
+    {
+        // the number of tasks currently running inline on this thread, each nested in the previous one
+        inline tls_variable<std::size_t> & _inline_depth()
+        {
+            static tls_variable<std::size_t> depth{ 0 };
+            return depth;
+        }
+
+        // runs f on the calling thread, unless that would nest more than max_depth inline tasks
+        // returns false if f wasn't run
+        template<typename F>
+        bool _try_run_inline(F && f, std::size_t max_depth)
+        {
+            std::size_t depth = _inline_depth();
+            if (depth >= max_depth)
+            {
+                return false;
+            }
+
+            _inline_depth() = depth + 1;
+
+            try
+            {
+                std::forward<F>(f)();
+            }
+
+            catch (...)
+            {
+                _inline_depth() = depth;
+                throw;
+            }
+
+            _inline_depth() = depth;
+            return true;
+        }
+    }
+
+    constexpr struct inline_type {} inline_ = {};
+
+    // runs tasks on the thread that pushes them
+    // to keep long chains of continuations from overflowing the stack, tasks that would be nested deeper than max_depth
+    // are pushed to the fallback executor instead (the default executor, unless specified otherwise)
+    class inline_executor : public executor
+    {
+    public:
+        static constexpr std::size_t default_max_depth = 64;
+
+        inline_executor(std::shared_ptr<executor> fallback = nullptr, std::size_t max_depth = default_max_depth) : _fallback{ std::move(fallback) }, _max_depth{ max_depth }
+        {
+        }
+
+        virtual void push(function<void ()> f) override
+        {
+            if (_detail::_try_run_inline(f, _max_depth))
+            {
+                return;
+            }
+
+            (_fallback ? _fallback : default_executor())->push(std::move(f));
+        }
+
+    private:
+        std::shared_ptr<executor> _fallback;
+        std::size_t _max_depth;
+    };
+}}
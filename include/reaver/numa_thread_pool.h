@@ -0,0 +1,156 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <limits>
+#include <algorithm>
+
+#include "thread_pool.h"
+#include "affinity.h"
+
+namespace reaver { inline namespace _v1
+{
+    namespace thread_pool_args
+    {
+        // the number of workers in each node's pool; 0 means one worker per cpu of the node
+        struct threads_per_node : kwargs::kwarg<std::size_t>
+        {
+            using kwarg::kwarg;
+        };
+    }
+
+    // a set of thread pools, one per NUMA node, with each pool's workers pinned to the cpus of its node
+    // push() prefers the pool of the node the pushing thread is running on, so continuations scheduled from a worker
+    // stay on its node; threads the node of which can't be determined are spread over the nodes round robin
+    class numa_thread_pool : public executor
+    {
+    public:
+        // accepts keyword arguments from thread_pool_args, which are passed on to the pools of all nodes, except for cpus,
+        // since the pool of each node is pinned to the cpus of that node; capacity and elastic apply to each pool on its own
+        template<typename... Args>
+        numa_thread_pool(Args &&... args) : numa_thread_pool{ numa_topology(), std::forward<Args>(args)... }
+        {
+        }
+
+        template<typename... Args>
+        numa_thread_pool(std::vector<numa_node> topology, Args &&... args)
+        {
+            static_assert(kwargs::_detail::_count<thread_pool_args::cpus, std::decay_t<Args>...>::value == 0,
+                "numa_thread_pool pins the pool of each node to the cpus of that node; it doesn't accept thread_pool_args::cpus.");
+
+            auto per_node = kwargs::get_or<thread_pool_args::threads_per_node>(0, std::forward<Args>(args)...);
+            auto policy = kwargs::get_or<thread_pool_args::idle>({}, std::forward<Args>(args)...);
+            auto elastic = kwargs::get_or<thread_pool_args::elastic>({}, std::forward<Args>(args)...);
+            auto capacity = kwargs::get_or<thread_pool_args::capacity>(0, std::forward<Args>(args)...);
+            auto overflow = kwargs::get_or<thread_pool_args::overflow>(overflow_policy::block, std::forward<Args>(args)...);
+            auto statistics = kwargs::get_or<thread_pool_args::statistics>(false, std::forward<Args>(args)...);
+            auto same_worker = kwargs::get_or<thread_pool_args::same_worker>(false, std::forward<Args>(args)...);
+
+            for (auto && node : topology)
+            {
+                auto size = per_node ? per_node : node.cpus.size();
+                if (!size)
+                {
+                    size = std::max(std::thread::hardware_concurrency(), 1u);
+                }
+
+                for (auto cpu : node.cpus)
+                {
+                    if (cpu >= _cpu_to_node.size())
+                    {
+                        _cpu_to_node.resize(cpu + 1, _no_node);
+                    }
+                    _cpu_to_node[cpu] = _nodes.size();
+                }
+
+                _nodes.push_back({ node.id, std::make_shared<thread_pool>(size,
+                    thread_pool_args::idle{ policy },
+                    thread_pool_args::cpus{ node.cpus },
+                    thread_pool_args::elastic{ elastic },
+                    thread_pool_args::capacity{ capacity },
+                    thread_pool_args::overflow{ overflow },
+                    thread_pool_args::statistics{ statistics },
+                    thread_pool_args::same_worker{ same_worker }) });
+            }
+        }
+
+        virtual void push(function<void ()> f) override
+        {
+            _nodes[_local_node()].pool->push(std::move(f));
+        }
+
+        virtual void push_bulk(std::vector<function<void ()>> tasks) override
+        {
+            _nodes[_local_node()].pool->push_bulk(std::move(tasks));
+        }
+
+        // index is a position in the list of nodes, between 0 and node_count(), not a node id
+        void push_to(std::size_t index, function<void ()> f)
+        {
+            _nodes.at(index).pool->push(std::move(f));
+        }
+
+        // the pool of a single node, for pinning a chain of continuations to it with then(sched, f)
+        std::shared_ptr<thread_pool> node(std::size_t index) const
+        {
+            return _nodes.at(index).pool;
+        }
+
+        std::size_t node_id(std::size_t index) const
+        {
+            return _nodes.at(index).id;
+        }
+
+        std::size_t node_count() const
+        {
+            return _nodes.size();
+        }
+
+    private:
+        static constexpr std::size_t _no_node = std::numeric_limits<std::size_t>::max();
+
+        std::size_t _local_node()
+        {
+            auto cpu = current_cpu();
+            if (cpu >= 0 && static_cast<std::size_t>(cpu) < _cpu_to_node.size() && _cpu_to_node[cpu] != _no_node)
+            {
+                return _cpu_to_node[cpu];
+            }
+
+            return _next.fetch_add(1, std::memory_order_relaxed) % _nodes.size();
+        }
+
+        struct _node
+        {
+            std::size_t id;
+            std::shared_ptr<thread_pool> pool;
+        };
+
+        std::vector<_node> _nodes;
+        std::vector<std::size_t> _cpu_to_node;
+        std::atomic<std::size_t> _next{ 0 };
+    };
+}}
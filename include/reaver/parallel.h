@@ -0,0 +1,295 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "future.h"
+#include "optional.h"
+
+namespace reaver { inline namespace _v1
+{
+    namespace _detail
+    {
+        // a few chunks per hardware thread, so that uneven chunks can still even out between the workers
+        inline std::size_t _parallel_grain(std::size_t size, std::size_t grain)
+        {
+            if (grain)
+            {
+                return grain;
+            }
+
+            std::size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+            return std::max<std::size_t>(size / (threads * 4), 1);
+        }
+
+        inline std::size_t _parallel_chunk_count(std::size_t size, std::size_t grain)
+        {
+            return (size + grain - 1) / grain;
+        }
+
+        // ranges are given either as a pair of random access iterators, or as a pair of integers
+        template<typename Iterator>
+        auto _parallel_element(const Iterator & first, std::size_t i, std::true_type)
+        {
+            return static_cast<Iterator>(first + i);
+        }
+
+        template<typename Iterator>
+        decltype(auto) _parallel_element(const Iterator & first, std::size_t i, std::false_type)
+        {
+            return *(first + i);
+        }
+
+        template<typename Iterator>
+        decltype(auto) _parallel_element(const Iterator & first, std::size_t i)
+        {
+            return _parallel_element(first, i, std::is_integral<Iterator>());
+        }
+
+        template<typename Iterator>
+        std::size_t _parallel_size(const Iterator & first, const Iterator & last)
+        {
+            return static_cast<std::size_t>(last - first);
+        }
+
+        template<typename Range>
+        using _parallel_range_iterator = decltype(std::begin(std::declval<Range &>()));
+
+        // runs f(chunk index, begin, end) for every grain-sized chunk of [0, size) on the executor
+        // the first exception thrown from a chunk is what the returned future ends up holding; chunks that haven't started yet
+        // by that time are skipped
+        template<typename F>
+        future<> _parallel_chunks(std::shared_ptr<executor> sched, std::size_t size, std::size_t grain, F f)
+        {
+            if (size == 0)
+            {
+                return make_ready_future();
+            }
+
+            struct internal_state
+            {
+                internal_state(std::shared_ptr<executor> sched, std::size_t size, std::size_t grain, F f)
+                    : sched{ std::move(sched) }, size{ size }, grain{ grain }, remaining{ _parallel_chunk_count(size, grain) }, function{ std::move(f) }
+                {
+                }
+
+                std::shared_ptr<executor> sched;
+                std::size_t size;
+                std::size_t grain;
+                std::atomic<std::size_t> remaining;
+                std::atomic<bool> failed{ false };
+                std::exception_ptr failure;
+                optional<packaged_task<void>> task;
+                const F function;
+            };
+
+            auto state = std::make_shared<internal_state>(std::move(sched), size, grain, std::move(f));
+            auto chunks = state->remaining.load();
+
+            // the task only ever runs from within the last chunk, which keeps the state alive
+            auto pair = package([state = state.get()]() {
+                if (state->failure)
+                {
+                    std::rethrow_exception(state->failure);
+                }
+            });
+            state->task = std::move(pair.packaged_task);
+
+            std::vector<function<void ()>> tasks;
+            tasks.reserve(chunks);
+
+            for (std::size_t i = 0; i < chunks; ++i)
+            {
+                tasks.emplace_back([state, i]() {
+                    if (!state->failed.load(std::memory_order_relaxed))
+                    {
+                        auto begin = i * state->grain;
+                        auto end = std::min(begin + state->grain, state->size);
+
+                        try
+                        {
+                            state->function(i, begin, end);
+                        }
+
+                        catch (...)
+                        {
+                            if (!state->failed.exchange(true))
+                            {
+                                state->failure = std::current_exception();
+                            }
+                        }
+                    }
+
+                    if (state->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    {
+                        auto task = std::move(*state->task);
+                        task(state->sched);
+                    }
+                });
+            }
+
+            state->sched->push_bulk(std::move(tasks));
+
+            return std::move(pair.future);
+        }
+    }
+
+    // calls f with every element of [first, last) (or with every integer in it), in grain-sized chunks pushed to the executor;
+    // a grain of 0 picks one based on the size of the range
+    // the range must outlive the returned future
+    template<typename Iterator, typename F>
+    future<> parallel_for(std::shared_ptr<executor> sched, Iterator first, Iterator last, F f, std::size_t grain = 0)
+    {
+        auto size = _detail::_parallel_size(first, last);
+
+        return _detail::_parallel_chunks(std::move(sched), size, _detail::_parallel_grain(size, grain),
+            [first, f = std::move(f)](std::size_t, std::size_t begin, std::size_t end) {
+                for (auto i = begin; i != end; ++i)
+                {
+                    f(_detail::_parallel_element(first, i));
+                }
+            }
+        );
+    }
+
+    template<typename Range, typename F, typename = _detail::_parallel_range_iterator<Range>>
+    future<> parallel_for(std::shared_ptr<executor> sched, Range && range, F f, std::size_t grain = 0)
+    {
+        return parallel_for(std::move(sched), std::begin(range), std::end(range), std::move(f), grain);
+    }
+
+    template<typename Iterator, typename F>
+    future<> parallel_for(Iterator first, Iterator last, F f, std::size_t grain = 0)
+    {
+        return parallel_for(default_executor(), std::move(first), std::move(last), std::move(f), grain);
+    }
+
+    template<typename Range, typename F, typename = _detail::_parallel_range_iterator<Range>>
+    future<> parallel_for(Range && range, F f, std::size_t grain = 0)
+    {
+        return parallel_for(default_executor(), std::begin(range), std::end(range), std::move(f), grain);
+    }
+
+    // *(out + i) = f(element i of [first, last))
+    template<typename Iterator, typename OutputIterator, typename F>
+    future<> parallel_transform(std::shared_ptr<executor> sched, Iterator first, Iterator last, OutputIterator out, F f, std::size_t grain = 0)
+    {
+        auto size = _detail::_parallel_size(first, last);
+
+        return _detail::_parallel_chunks(std::move(sched), size, _detail::_parallel_grain(size, grain),
+            [first, out, f = std::move(f)](std::size_t, std::size_t begin, std::size_t end) {
+                for (auto i = begin; i != end; ++i)
+                {
+                    *(out + i) = f(_detail::_parallel_element(first, i));
+                }
+            }
+        );
+    }
+
+    // maps the range into a new vector; the result type must be default constructible
+    template<typename Range, typename F, typename = _detail::_parallel_range_iterator<Range>>
+    auto parallel_transform(std::shared_ptr<executor> sched, Range && range, F f, std::size_t grain = 0)
+    {
+        using result_type = std::decay_t<decltype(f(*std::begin(range)))>;
+
+        auto results = std::make_shared<std::vector<result_type>>(_detail::_parallel_size(std::begin(range), std::end(range)));
+
+        return parallel_transform(std::move(sched), std::begin(range), std::end(range), results->begin(), std::move(f), grain)
+            .then(inline_, [results]() {
+                return std::move(*results);
+            });
+    }
+
+    template<typename Iterator, typename OutputIterator, typename F>
+    future<> parallel_transform(Iterator first, Iterator last, OutputIterator out, F f, std::size_t grain = 0)
+    {
+        return parallel_transform(default_executor(), std::move(first), std::move(last), std::move(out), std::move(f), grain);
+    }
+
+    template<typename Range, typename F, typename = _detail::_parallel_range_iterator<Range>>
+    auto parallel_transform(Range && range, F f, std::size_t grain = 0)
+    {
+        return parallel_transform(default_executor(), std::forward<Range>(range), std::move(f), grain);
+    }
+
+    // folds every chunk separately, starting from its first element, and then folds the partial results into init in order
+    // op must therefore be associative, but doesn't need an identity element
+    template<typename Iterator, typename T, typename Op>
+    future<T> parallel_reduce(std::shared_ptr<executor> sched, Iterator first, Iterator last, T init, Op op, std::size_t grain = 0)
+    {
+        auto size = _detail::_parallel_size(first, last);
+
+        if (size == 0)
+        {
+            return make_ready_future(std::move(init));
+        }
+
+        grain = _detail::_parallel_grain(size, grain);
+
+        auto partials = std::make_shared<std::vector<optional<T>>>(_detail::_parallel_chunk_count(size, grain));
+
+        return _detail::_parallel_chunks(std::move(sched), size, grain,
+            [first, op, partials](std::size_t chunk, std::size_t begin, std::size_t end) {
+                T accumulator = _detail::_parallel_element(first, begin);
+                for (auto i = begin + 1; i != end; ++i)
+                {
+                    accumulator = op(std::move(accumulator), _detail::_parallel_element(first, i));
+                }
+
+                (*partials)[chunk] = std::move(accumulator);
+            }
+        ).then(inline_, [init = std::move(init), op, partials]() mutable {
+            for (auto && partial : *partials)
+            {
+                init = op(std::move(init), std::move(*partial));
+            }
+
+            return std::move(init);
+        });
+    }
+
+    template<typename Range, typename T, typename Op, typename = _detail::_parallel_range_iterator<Range>>
+    future<T> parallel_reduce(std::shared_ptr<executor> sched, Range && range, T init, Op op, std::size_t grain = 0)
+    {
+        return parallel_reduce(std::move(sched), std::begin(range), std::end(range), std::move(init), std::move(op), grain);
+    }
+
+    template<typename Iterator, typename T, typename Op>
+    future<T> parallel_reduce(Iterator first, Iterator last, T init, Op op, std::size_t grain = 0)
+    {
+        return parallel_reduce(default_executor(), std::move(first), std::move(last), std::move(init), std::move(op), grain);
+    }
+
+    template<typename Range, typename T, typename Op, typename = _detail::_parallel_range_iterator<Range>>
+    future<T> parallel_reduce(Range && range, T init, Op op, std::size_t grain = 0)
+    {
+        return parallel_reduce(default_executor(), std::begin(range), std::end(range), std::move(init), std::move(op), grain);
+    }
+}}
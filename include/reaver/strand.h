@@ -0,0 +1,202 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+
+#pragma once
+
+#include <memory>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+
+#include "executor.h"
+#include "default_executor.h"
+
+namespace reaver { inline namespace _v1
+{
+    // runs the tasks pushed to it one at a time, in the order they were pushed, on an underlying executor
+    // (the default executor, unless specified otherwise)
+    // at most one task draining the strand is pushed to the underlying executor at a time; it runs up to max_batch tasks
+    // before it gives the underlying executor's thread back and pushes itself again
+    class strand : public executor
+    {
+    public:
+        static constexpr std::size_t default_max_batch = 64;
+
+        strand(std::shared_ptr<executor> underlying = nullptr, std::size_t max_batch = default_max_batch)
+            : _state{ std::make_shared<_shared_state>(underlying ? std::move(underlying) : default_executor(), max_batch) }
+        {
+        }
+
+        // if the underlying executor refuses the drain task, the exception is propagated and the task is dropped; the tasks
+        // pushed by others in the meantime still run, on this thread if the underlying executor keeps refusing
+        virtual void push(function<void ()> f) override
+        {
+            auto node = new _node{ std::move(f) };
+            _state->push(node);
+
+            if (_state->pending.fetch_add(1, std::memory_order_acq_rel) == 0)
+            {
+                try
+                {
+                    _schedule(_state);
+                }
+
+                catch (...)
+                {
+                    // until a drain task is scheduled, this is the only thread allowed to touch the queued tasks
+                    node->f = []{};
+                    _reschedule(_state);
+                    throw;
+                }
+            }
+        }
+
+    private:
+        struct _node
+        {
+            _node(function<void ()> f) : f{ std::move(f) }
+            {
+            }
+
+            std::atomic<_node *> next{ nullptr };
+            function<void ()> f;
+        };
+
+        // a multiple producer, single consumer intrusive queue; the consumer is whichever drain task is running
+        // head always points at a node whose task has already been taken, the initial stub or the last one popped
+        struct _shared_state
+        {
+            _shared_state(std::shared_ptr<executor> underlying, std::size_t max_batch) : underlying{ std::move(underlying) }, max_batch{ max_batch ? max_batch : 1 }
+            {
+            }
+
+            ~_shared_state()
+            {
+                while (head)
+                {
+                    auto next = head->next.load(std::memory_order_relaxed);
+                    delete head;
+                    head = next;
+                }
+            }
+
+            void push(_node * node)
+            {
+                auto prev = tail.exchange(node, std::memory_order_acq_rel);
+                prev->next.store(node, std::memory_order_release);
+            }
+
+            // must only be called after `pending` has shown that a task was pushed; the producer might still be between
+            // the two steps of push(), in which case this waits for it
+            function<void ()> pop()
+            {
+                _node * next;
+                while (!(next = head->next.load(std::memory_order_acquire)))
+                {
+                    std::this_thread::yield();
+                }
+
+                delete head;
+                head = next;
+
+                return std::move(next->f);
+            }
+
+            std::shared_ptr<executor> underlying;
+            std::size_t max_batch;
+
+            std::atomic<std::size_t> pending{ 0 };
+            _node * head = new _node{ []{} };
+            std::atomic<_node *> tail{ head };
+        };
+
+        static void _schedule(std::shared_ptr<_shared_state> state)
+        {
+            auto underlying = state->underlying;
+            underlying->push([state = std::move(state)]{ _drain(state); });
+        }
+
+        // must only be called by the thread that's allowed to drain the strand; if the underlying executor refuses the drain
+        // task, it drains the strand itself, so that the strand isn't left waiting for a drain task that never comes
+        static void _reschedule(const std::shared_ptr<_shared_state> & state)
+        {
+            try
+            {
+                _schedule(state);
+                return;
+            }
+
+            catch (...)
+            {
+            }
+
+            _drain(state);
+        }
+
+        static void _drain(const std::shared_ptr<_shared_state> & state)
+        {
+            while (true)
+            {
+                for (std::size_t i = 0; i < state->max_batch; ++i)
+                {
+                    auto f = state->pop();
+
+                    try
+                    {
+                        f();
+                    }
+
+                    catch (...)
+                    {
+                        // keep the strand going for the tasks behind the one that threw
+                        if (state->pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                        {
+                            _reschedule(state);
+                        }
+
+                        throw;
+                    }
+
+                    if (state->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    {
+                        return;
+                    }
+                }
+
+                try
+                {
+                    _schedule(state);
+                    return;
+                }
+
+                // the underlying executor refused to take the thread back; keep draining on this one instead
+                catch (...)
+                {
+                }
+            }
+        }
+
+        std::shared_ptr<_shared_state> _state;
+    };
+
+    using serial_executor = strand;
+}}
@@ -31,16 +31,30 @@
 #include <mutex>
 #include <future>
 #include <type_traits>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <array>
+#include <memory>
+#include <cstdint>
+#include <iterator>
 
 #include "exception.h"
 #include "callbacks.h"
 #include "thread.h"
-#include "semaphore.h"
 #include "executor.h"
 #include "optional.h"
+#include "kwargs.h"
+#include "affinity.h"
+#include "tls.h"
 
 namespace reaver { inline namespace _v1
 {
+    // shutdown() and resize() return futures; they are defined in thread_pool_futures.h, which future.h includes, since
+    // future.h needs the thread pool for the default executor
+    template<typename T>
+    class future;
+
     class thread_pool_closed : public exception
     {
     public:
@@ -50,11 +64,227 @@ namespace reaver { inline namespace _v1
         }
     };
 
+    class thread_pool_full : public exception
+    {
+    public:
+        thread_pool_full() : exception{ logger::error }
+        {
+            *this << "tried to insert a task into a thread pool with a full queue.";
+        }
+    };
+
+    // what push() does when the queue of a thread_pool with a capacity is full
+    // the workers of the pool never block or get thrown at for pushing into their own pool: with block and reject, their
+    // tasks are queued past the capacity, since they are the only ones who can make room in the queue, and since a task
+    // pushed through the executor interface (like a continuation) has nobody to catch an exception
+    enum class overflow_policy
+    {
+        // wait until workers make enough room in the queue
+        block,
+        // run the task on the calling thread instead
+        run_inline,
+        // throw thread_pool_full
+        reject
+    };
+
+    namespace _detail
+    {
+        inline void _cpu_relax()
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+            asm volatile("yield");
+#endif
+        }
+    }
+
+    // what an idle worker does before it goes to sleep on the condition variable: first it polls the queue `spins` times
+    // with a pause in between, then `yields` times with a std::this_thread::yield() in between
+    // spinning cuts the latency of tasks pushed shortly after the queue went empty, at the cost of burning cpu while idle;
+    // the default is to go to sleep straight away
+    struct idle_policy
+    {
+        std::size_t spins = 0;
+        std::size_t yields = 0;
+    };
+
+    // bounds and thresholds of an elastic thread_pool, which resizes itself within [min, max]:
+    // - when a task has been waiting in the queue for longer than grow_after and no worker is parked, a worker is added
+    // - when a worker has been parked for longer than shrink_after, it exits
+    // max == 0 disables elastic sizing
+    struct elastic_policy
+    {
+        std::size_t min = 1;
+        std::size_t max = 0;
+        std::chrono::microseconds grow_after{ 1000 };
+        std::chrono::milliseconds shrink_after{ 10000 };
+    };
+
+    // a histogram of durations, with power of two buckets: bucket i counts durations in [2^i, 2^(i+1)) nanoseconds
+    // (bucket 0 also counts zero, and the last bucket also counts everything longer)
+    struct latency_histogram
+    {
+        static constexpr std::size_t bucket_count = 40;
+
+        static std::size_t bucket(std::chrono::nanoseconds duration)
+        {
+            auto ns = static_cast<std::uint64_t>(std::max<std::chrono::nanoseconds::rep>(duration.count(), 1));
+            std::size_t log = 63 - __builtin_clzll(ns);
+            return std::min(log, bucket_count - 1);
+        }
+
+        std::uint64_t count() const
+        {
+            std::uint64_t ret = 0;
+            for (auto bucket : buckets)
+            {
+                ret += bucket;
+            }
+            return ret;
+        }
+
+        // the upper bound of the bucket the given quantile falls into, e.g. quantile(0.99) for the 99th percentile
+        std::chrono::nanoseconds quantile(double q) const
+        {
+            auto rank = static_cast<std::uint64_t>(q * count());
+            std::uint64_t seen = 0;
+
+            for (std::size_t i = 0; i < bucket_count; ++i)
+            {
+                seen += buckets[i];
+                if (seen > rank)
+                {
+                    return std::chrono::nanoseconds{ std::int64_t{ 2 } << i };
+                }
+            }
+
+            return std::chrono::nanoseconds{ std::int64_t{ 2 } << (bucket_count - 1) };
+        }
+
+        latency_histogram & operator+=(const latency_histogram & other)
+        {
+            for (std::size_t i = 0; i < bucket_count; ++i)
+            {
+                buckets[i] += other.buckets[i];
+            }
+            return *this;
+        }
+
+        std::array<std::uint64_t, bucket_count> buckets{};
+    };
+
+    struct worker_statistics
+    {
+        std::uint64_t executed = 0;
+        std::chrono::nanoseconds busy{ 0 };
+        std::chrono::nanoseconds idle{ 0 };
+        // from the push of a task to the start of its execution
+        latency_histogram latency;
+
+        worker_statistics & operator+=(const worker_statistics & other)
+        {
+            executed += other.executed;
+            busy += other.busy;
+            idle += other.idle;
+            latency += other.latency;
+            return *this;
+        }
+    };
+
+    struct thread_pool_statistics
+    {
+        std::size_t workers = 0;
+        std::size_t queue_depth = 0;
+        // the sum over all workers, including the ones that have already exited
+        worker_statistics total;
+        // only the workers that are currently running
+        std::vector<worker_statistics> per_worker;
+    };
+
+    namespace thread_pool_args
+    {
+        struct idle : kwargs::kwarg<idle_policy>
+        {
+            using kwarg::kwarg;
+        };
+
+        // the cpus the workers are allowed to run on; an empty list means no restriction
+        struct cpus : kwargs::kwarg<std::vector<std::size_t>>
+        {
+            using kwarg::kwarg;
+        };
+
+        struct elastic : kwargs::kwarg<elastic_policy>
+        {
+            using kwarg::kwarg;
+        };
+
+        // the maximum number of queued tasks, across all lanes; 0 means unbounded
+        struct capacity : kwargs::kwarg<std::size_t>
+        {
+            using kwarg::kwarg;
+        };
+
+        struct overflow : kwargs::kwarg<overflow_policy>
+        {
+            using kwarg::kwarg;
+        };
+
+        // enables thread_pool::statistics(); costs two clock reads per task, plus one per push
+        struct statistics : kwargs::kwarg<bool>
+        {
+            using kwarg::kwarg;
+        };
+
+        // tasks pushed through the executor interface by a worker of the pool are run by that same worker, right after
+        // its current task, so that a continuation finds the data of the task that scheduled it still in cache
+        // each worker keeps only the newest such task to itself; an older one goes to the queue, for any worker to take
+        // a task must not block waiting for one it pushed itself in a pool with this enabled, since that one waits for it
+        struct same_worker : kwargs::kwarg<bool>
+        {
+            using kwarg::kwarg;
+        };
+    }
+
+    // the lanes of a thread_pool; workers take tasks from the highest non-empty lane, except when a lower lane has been
+    // passed over too many times in a row (see thread_pool::starvation_limit)
+    enum class priority
+    {
+        high,
+        normal,
+        background
+    };
+
     class thread_pool : public executor
     {
     public:
-        thread_pool(std::size_t size)
+        // how many tasks from higher lanes may be taken while a lower lane is waiting, before its next task is taken
+        static constexpr std::size_t starvation_limit = 32;
+
+        thread_pool(std::size_t size, idle_policy policy = {}) : thread_pool{ size, thread_pool_args::idle{ policy } }
         {
+        }
+
+        // accepts keyword arguments from thread_pool_args
+        template<typename... Args>
+        thread_pool(std::size_t size, Args &&... args)
+            : _policy{ kwargs::get_or<thread_pool_args::idle>({}, std::forward<Args>(args)...) },
+            _cpus{ kwargs::get_or<thread_pool_args::cpus>({}, std::forward<Args>(args)...) },
+            _elastic{ kwargs::get_or<thread_pool_args::elastic>({}, std::forward<Args>(args)...) },
+            _capacity{ kwargs::get_or<thread_pool_args::capacity>(0, std::forward<Args>(args)...) },
+            _overflow{ kwargs::get_or<thread_pool_args::overflow>(overflow_policy::block, std::forward<Args>(args)...) },
+            _statistics{ kwargs::get_or<thread_pool_args::statistics>(false, std::forward<Args>(args)...) },
+            _same_worker{ kwargs::get_or<thread_pool_args::same_worker>(false, std::forward<Args>(args)...) }
+        {
+            if (_elastic.max)
+            {
+                size = std::min(std::max(size, _elastic.min), _elastic.max);
+            }
+
+            std::unique_lock<std::mutex> lock{ _lock };
+
+            _target = size;
             while (size--)
             {
                 _spawn();
@@ -63,10 +293,13 @@ namespace reaver { inline namespace _v1
 
         ~thread_pool()
         {
+            _completions completed;
+
             {
                 std::unique_lock<std::mutex> lock{ _lock };
                 _end = true;
                 _cond.notify_all();
+                _not_full.notify_all();
             }
 
             for (auto & th : _threads)
@@ -83,6 +316,10 @@ namespace reaver { inline namespace _v1
                 {
                 }
             }
+
+            _reap();
+            _drained(completed);
+            completed.take(_resized);
         }
 
         void abort()
@@ -90,9 +327,10 @@ namespace reaver { inline namespace _v1
             {
                 std::unique_lock<std::mutex> lock{ _lock };
 
-                _queue = decltype(_queue){};
+                _drop_queued();
                 _end = true;
                 _cond.notify_all();
+                _not_full.notify_all();
             }
 
             for (auto & th : _threads)
@@ -106,10 +344,36 @@ namespace reaver { inline namespace _v1
                 {
                 }
             }
+
+            _reap();
+
+            _completions completed;
+            std::unique_lock<std::mutex> lock{ _lock };
+            _drained(completed);
         }
 
+        // stops accepting new tasks (push() throws thread_pool_closed from now on) and lets the workers finish the tasks that
+        // are already queued, after which they exit; the returned future becomes ready once they all have
+        // tasks pushed by the workers themselves, like continuations of the tasks being drained, are still accepted
+        // doesn't block, unlike the destructor
+        future<void> shutdown();
+
+        // tasks that are still queued once the deadline has passed are dropped instead of executed; the futures returned by
+        // push() for them throw std::future_error with broken_promise
+        // tasks that are already running at that point are not interrupted
+        future<void> shutdown(std::chrono::steady_clock::time_point deadline);
+
+        template<typename Rep, typename Period>
+        future<void> shutdown(std::chrono::duration<Rep, Period> timeout);
+
         template<typename F, typename... Args>
         std::future<typename std::result_of<F (Args...)>::type> push(F && f, Args &&... args)
+        {
+            return push(priority::normal, std::forward<F>(f), std::forward<Args>(args)...);
+        }
+
+        template<typename F, typename... Args>
+        std::future<typename std::result_of<F (Args...)>::type> push(priority lane, F && f, Args &&... args)
         {
             auto task = std::make_shared<std::packaged_task<typename std::result_of<F (Args...)>::type ()>>(
                 std::bind(std::forward<F>(f), std::forward<Args>(args)...));
@@ -118,12 +382,26 @@ namespace reaver { inline namespace _v1
             {
                 std::unique_lock<std::mutex> lock{ _lock };
 
-                if (_end)
+                if (_end || (_draining && !_on_worker()))
                 {
                     throw thread_pool_closed{};
                 }
 
-                _queue.emplace([task]{ (*task)(); });
+                if (!_admit(lock, 1))
+                {
+                    lock.unlock();
+                    (*task)();
+                    return future;
+                }
+
+                _lane(lane).push({ [task]{ (*task)(); }, _stamp() });
+                ++_queued;
+                _maybe_grow();
+
+                if (!_parked)
+                {
+                    return future;
+                }
             }
 
             _cond.notify_one();
@@ -132,93 +410,337 @@ namespace reaver { inline namespace _v1
         }
 
         virtual void push(function<void ()> f) override
+        {
+            if (_same_worker && _push_local(f))
+            {
+                return;
+            }
+
+            push(priority::normal, std::move(f));
+        }
+
+        void push(priority lane, function<void ()> f)
         {
             std::unique_lock<std::mutex> lock{ _lock };
-            _queue.emplace(std::move(f));
-            _cond.notify_one();
+
+            if (!_admit(lock, 1))
+            {
+                lock.unlock();
+                f();
+                return;
+            }
+
+            _enqueue(lane, std::move(f));
         }
 
-        std::size_t size() const
+        // returns false when the queue is full, regardless of the overflow policy
+        bool try_push(function<void ()> f)
         {
-            return _size;
+            return try_push(priority::normal, std::move(f));
         }
 
-        void resize(std::size_t new_size)
+        bool try_push(priority lane, function<void ()> f)
         {
             std::unique_lock<std::mutex> lock{ _lock };
 
-            if (new_size == _size)
+            if (_draining && !_on_worker())
+            {
+                throw thread_pool_closed{};
+            }
+
+            if (_capacity && _queued >= _capacity)
+            {
+                return false;
+            }
+
+            _enqueue(lane, std::move(f));
+            return true;
+        }
+
+        virtual void push_bulk(std::vector<function<void ()>> tasks) override
+        {
+            push_bulk(priority::normal, std::move(tasks));
+        }
+
+        void push_bulk(priority lane, std::vector<function<void ()>> tasks)
+        {
+            if (tasks.empty())
             {
                 return;
             }
 
-            if (new_size > _size)
+            std::unique_lock<std::mutex> lock{ _lock };
+
+            auto admitted = _admit(lock, tasks.size());
+
+            auto stamp = _stamp();
+            for (std::size_t i = 0; i < admitted; ++i)
+            {
+                _lane(lane).push({ std::move(tasks[i]), stamp });
+            }
+            _queued += admitted;
+            _maybe_grow();
+
+            if (_parked && admitted >= _parked)
+            {
+                _cond.notify_all();
+            }
+
+            else if (_parked)
             {
-                while (_size < new_size)
+                for (std::size_t i = 0; i < admitted; ++i)
                 {
-                    _spawn();
+                    _cond.notify_one();
                 }
+            }
 
-                return;
+            lock.unlock();
+
+            for (std::size_t i = admitted; i < tasks.size(); ++i)
+            {
+                tasks[i]();
+            }
+        }
+
+        // the number of tasks waiting in the queue, across all lanes
+        std::size_t queue_depth() const
+        {
+            return _queued.load(std::memory_order_relaxed);
+        }
+
+        // only workers and queue_depth are filled in, unless the pool was created with thread_pool_args::statistics{ true }
+        thread_pool_statistics statistics()
+        {
+            thread_pool_statistics ret;
+            ret.queue_depth = queue_depth();
+
+            std::unique_lock<std::mutex> lock{ _lock };
+            ret.workers = _size;
+
+            for (auto && counters : _counters)
+            {
+                auto snapshot = counters->snapshot();
+                ret.total += snapshot;
+
+                if (counters->in_use)
+                {
+                    ret.per_worker.push_back(snapshot);
+                }
             }
 
-            _die_semaphore.notify(_size - new_size);
-            _cond.notify_all();
+            return ret;
         }
 
+        std::size_t size() const
+        {
+            return _size;
+        }
+
+        // the returned future becomes ready once the pool has new_size workers, i.e. once enough workers have finished
+        // their current tasks and exited when shrinking; growing completes immediately
+        // the remaining workers take over the queued tasks; only the last worker, when shrinking to 0, waits for the queue to
+        // empty before it exits, so that queued tasks are never stranded
+        // a resize that's still pending when resize() is called again, or when the pool is destroyed, is completed right away,
+        // since its size won't be reached
+        future<void> resize(std::size_t new_size);
+
     private:
-        void _loop()
+        // the futures returned by shutdown() and resize() that are due; they are completed when this goes out of scope, which
+        // must happen after _lock is released, since their continuations may push into the pool
+        class _completions
         {
+        public:
+            _completions() = default;
+            _completions(const _completions &) = delete;
+            _completions & operator=(const _completions &) = delete;
+
+            ~_completions()
+            {
+                for (auto && complete : _due)
+                {
+                    complete();
+                }
+            }
+
+            void take(std::vector<function<void ()>> & pending)
+            {
+                std::move(pending.begin(), pending.end(), std::back_inserter(_due));
+                pending.clear();
+            }
+
+            void add(function<void ()> complete)
+            {
+                _due.push_back(std::move(complete));
+            }
+
+        private:
+            std::vector<function<void ()>> _due;
+        };
+
+        // written only by the worker that owns them, and read by statistics(); each on its own cache lines
+        struct alignas(64) _worker_counters
+        {
+            void record(std::chrono::nanoseconds latency, std::chrono::nanoseconds idle_time, std::chrono::nanoseconds busy_time)
+            {
+                _bump(idle, idle_time.count());
+                _bump(busy, busy_time.count());
+                _bump(latency_buckets[latency_histogram::bucket(latency)], 1);
+
+                // last, so that a snapshot that counts the task also sees the rest of what it recorded
+                executed.store(executed.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            }
+
+            worker_statistics snapshot() const
+            {
+                worker_statistics ret;
+                ret.executed = executed.load(std::memory_order_acquire);
+                ret.busy = std::chrono::nanoseconds{ busy.load(std::memory_order_relaxed) };
+                ret.idle = std::chrono::nanoseconds{ idle.load(std::memory_order_relaxed) };
+
+                for (std::size_t i = 0; i < latency_histogram::bucket_count; ++i)
+                {
+                    ret.latency.buckets[i] = latency_buckets[i].load(std::memory_order_relaxed);
+                }
+
+                return ret;
+            }
+
+            // there's a single writer, so there's no need for a locked read-modify-write
+            template<typename T>
+            static void _bump(std::atomic<T> & counter, typename std::atomic<T>::value_type value)
+            {
+                counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+            }
+
+            std::atomic<std::uint64_t> executed{ 0 };
+            std::atomic<std::int64_t> busy{ 0 };
+            std::atomic<std::int64_t> idle{ 0 };
+            std::array<std::atomic<std::uint64_t>, latency_histogram::bucket_count> latency_buckets{};
+
+            // guarded by _lock
+            bool in_use = false;
+        };
+
+        void _loop(_worker_counters * counters)
+        {
+            pin_current_thread(_cpus);
+
+            // the thread exits right after this function returns, so the pointer is never read once the slot is gone
+            _local_slot slot{ this };
+            _current_slot() = &slot;
+
+            auto idle_since = counters ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+
             if (_waiters)
             {
                 std::unique_lock<std::mutex> lock{ _lock };
                 _waiters();
             }
 
-            while (!_end || _threads.size())
+            while (true)
             {
+                optional<function<void ()>> f;
+                std::chrono::steady_clock::time_point enqueued;
+
+                if (slot.task && slot.taken < starvation_limit)
                 {
+                    ++slot.taken;
+                    enqueued = (*slot.task).enqueued;
+                    f = std::move((*slot.task).f);
+                    slot.task = none;
+                }
+
+                else
+                {
+                    slot.taken = 0;
+
+                    _completions completed;
                     std::unique_lock<std::mutex> lock{ _lock };
 
-                    if (_try_die())
+                    // the queue has been passed over for long enough; the task in the slot waits its turn in it instead
+                    if (slot.task)
+                    {
+                        _enqueue(priority::normal, std::move((*slot.task).f));
+                        slot.task = none;
+                    }
+
+                    if (!_end && _size > _target && (_target || !_queued))
                     {
+                        _retire(counters, completed);
                         return;
                     }
-                }
 
-                optional<function<void ()>> f;
+                    if (_draining && _queued && std::chrono::steady_clock::now() >= _deadline)
+                    {
+                        _drop_queued();
+                    }
 
-                {
-                    std::unique_lock<std::mutex> lock{ _lock };
+                    if (!_end && !_draining && !_queued && (_policy.spins || _policy.yields))
+                    {
+                        lock.unlock();
+                        _spin();
+                        lock.lock();
+                    }
 
-                    while (!_end && _queue.empty())
+                    while (!_end && !_draining && !_queued)
                     {
-                        if (_try_die())
+                        if (_size > _target)
                         {
+                            _retire(counters, completed);
                             return;
                         }
 
-                        _cond.wait(lock);
+                        auto status = std::cv_status::no_timeout;
+
+                        ++_parked;
+                        if (_elastic.max)
+                        {
+                            status = _cond.wait_for(lock, _elastic.shrink_after);
+                        }
+                        else
+                        {
+                            _cond.wait(lock);
+                        }
+                        --_parked;
+
+                        if (status == std::cv_status::timeout && !_end && !_queued && _size > _elastic.min)
+                        {
+                            --_target;
+                            _retire(counters, completed);
+                            return;
+                        }
                     }
 
-                    if (_end && _queue.empty())
+                    if (!_queued)
                     {
+                        if (_draining && !_end)
+                        {
+                            _leave_drained(completed);
+                        }
+
                         return;
                     }
 
-                    if (_queue.size())
-                    {
-                        f = std::move(_queue.front());
-                        _queue.pop();
-                    }
+                    auto task = _pop();
+                    f = std::move(task.f);
+                    enqueued = task.enqueued;
+                    _maybe_grow();
+                }
 
-                    else
-                    {
-                        continue;
-                    }
+                if (counters)
+                {
+                    auto start = std::chrono::steady_clock::now();
+                    fmap(std::move(f), [](auto f){ f(); return unit{}; });
+                    auto end = std::chrono::steady_clock::now();
+
+                    counters->record(start - enqueued, start - idle_since, end - start);
+                    idle_since = end;
                 }
 
-                fmap(std::move(f), [](auto f){ f(); return unit{}; });
+                else
+                {
+                    fmap(std::move(f), [](auto f){ f(); return unit{}; });
+                }
 
                 if (_waiters)
                 {
@@ -228,22 +750,311 @@ namespace reaver { inline namespace _v1
             }
         }
 
-        bool _try_die()
+        // must be called with _lock held
+        void _drop_queued()
+        {
+            _queues = decltype(_queues){};
+            _skipped = decltype(_skipped){};
+            _queued = 0;
+            _not_full.notify_all();
+        }
+
+        // must be called with _lock held, by a worker that found the queue empty during a shutdown
+        // the worker stays in _threads, to be joined by the destructor
+        void _leave_drained(_completions & completed)
+        {
+            if (--_size == 0)
+            {
+                _end = true;
+                _drained(completed);
+            }
+        }
+
+        // must be called with _lock held, or once all the workers are joined
+        void _drained(_completions & completed)
+        {
+            completed.take(_shutdowns);
+        }
+
+        // must be called with _lock held
+        void _enqueue(priority lane, function<void ()> f)
+        {
+            _lane(lane).push({ std::move(f), _stamp() });
+            ++_queued;
+            _maybe_grow();
+
+            // spinning workers will notice the new task on their own
+            if (_parked)
+            {
+                _cond.notify_one();
+            }
+        }
+
+        // must be called with _lock held
+        // applies the overflow policy; returns how many of the count tasks may be queued, the rest are to be run inline by
+        // the caller
+        std::size_t _admit(std::unique_lock<std::mutex> & lock, std::size_t count)
+        {
+            // a worker pushing while draining is most likely scheduling a continuation of a task being drained, and
+            // there's nobody to catch the exception if it does that through the executor interface
+            if (_draining && !_on_worker())
+            {
+                throw thread_pool_closed{};
+            }
+
+            if (!_capacity || _queued + count <= _capacity)
+            {
+                return count;
+            }
+
+            if (_overflow != overflow_policy::run_inline && _on_worker())
+            {
+                return count;
+            }
+
+            switch (_overflow)
+            {
+                case overflow_policy::block:
+                    ++_blocked;
+                    // a batch larger than the capacity is let in once the queue is empty, instead of blocking forever
+                    _not_full.wait(lock, [&]{ return _end || _draining || _queued + count <= _capacity || !_queued; });
+                    --_blocked;
+
+                    if (_end || _draining)
+                    {
+                        throw thread_pool_closed{};
+                    }
+
+                    return count;
+
+                case overflow_policy::run_inline:
+                    return _capacity > _queued ? _capacity - _queued : 0;
+
+                case overflow_policy::reject:
+                    throw thread_pool_full{};
+            }
+
+            return count;
+        }
+
+        struct _task
+        {
+            function<void ()> f;
+            // only set in elastic pools and pools with statistics, since it's not needed otherwise
+            std::chrono::steady_clock::time_point enqueued;
+        };
+
+        // the task a worker pushed last, and how many tasks in a row it has taken from there instead of from the queue
+        // every worker has one, whether the pool uses them or not, so that pushes can tell the pool's own workers apart
+        struct _local_slot
+        {
+            thread_pool * owner;
+            optional<_task> task;
+            std::size_t taken = 0;
+        };
+
+        static tls_variable<_local_slot *> & _current_slot()
+        {
+            static tls_variable<_local_slot *> current{ nullptr };
+            return current;
+        }
+
+        bool _on_worker() const
+        {
+            _local_slot * slot = _current_slot();
+            return slot && slot->owner == this;
+        }
+
+        // returns false if the caller isn't a worker of this pool, or if the pool is shutting down
+        bool _push_local(function<void ()> & f)
+        {
+            if (!_on_worker() || _draining)
+            {
+                return false;
+            }
+
+            _local_slot * slot = _current_slot();
+
+            optional<_task> previous = std::move(slot->task);
+            slot->task = _task{ std::move(f), _stamp() };
+
+            if (previous)
+            {
+                push(priority::normal, std::move((*previous).f));
+            }
+
+            return true;
+        }
+
+        std::chrono::steady_clock::time_point _stamp() const
+        {
+            return _elastic.max || _statistics ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+        }
+
+        // must be called with _lock held
+        // adds a worker if the oldest queued task has been waiting for too long and there's no parked worker to take it
+        void _maybe_grow()
+        {
+            if (!_elastic.max || _end || _draining || _parked || !_queued || _size >= _elastic.max)
+            {
+                return;
+            }
+
+            auto oldest = std::chrono::steady_clock::time_point::max();
+            for (auto && queue : _queues)
+            {
+                if (queue.size())
+                {
+                    oldest = std::min(oldest, queue.front().enqueued);
+                }
+            }
+
+            if (std::chrono::steady_clock::now() - oldest > _elastic.grow_after)
+            {
+                ++_target;
+                _spawn();
+            }
+        }
+
+        std::queue<_task> & _lane(priority lane)
+        {
+            return _queues[static_cast<std::size_t>(lane)];
+        }
+
+        // must be called with _lock held and with at least one task queued
+        _task _pop()
+        {
+            std::size_t chosen = _queues.size();
+
+            for (std::size_t i = _queues.size(); i-- > 0; )
+            {
+                if (_queues[i].size() && _skipped[i] >= starvation_limit)
+                {
+                    chosen = i;
+                    break;
+                }
+            }
+
+            if (chosen == _queues.size())
+            {
+                chosen = 0;
+                while (_queues[chosen].empty())
+                {
+                    ++chosen;
+                }
+            }
+
+            for (std::size_t i = chosen + 1; i < _queues.size(); ++i)
+            {
+                if (_queues[i].size())
+                {
+                    ++_skipped[i];
+                }
+            }
+            _skipped[chosen] = 0;
+
+            auto task = std::move(_queues[chosen].front());
+            _queues[chosen].pop();
+            --_queued;
+
+            if (_blocked)
+            {
+                _not_full.notify_all();
+            }
+
+            return task;
+        }
+
+        // returns as soon as there's something for the worker to do, or once the policy says it's time to go to sleep
+        void _spin()
+        {
+            auto done = [&]{
+                return _queued.load(std::memory_order_relaxed) || _end.load(std::memory_order_relaxed) || _draining.load(std::memory_order_relaxed);
+            };
+
+            for (std::size_t i = 0; i < _policy.spins; ++i)
+            {
+                if (done())
+                {
+                    return;
+                }
+
+                _detail::_cpu_relax();
+            }
+
+            for (std::size_t i = 0; i < _policy.yields; ++i)
+            {
+                if (done())
+                {
+                    return;
+                }
+
+                std::this_thread::yield();
+            }
+        }
+
+        // must be called with _lock held, by a worker that's about to return from _loop
+        // the thread object is kept around until the next _spawn or the destruction of the pool joins it
+        void _retire(_worker_counters * counters, _completions & completed)
         {
-            if (_die_semaphore.try_wait())
+            if (counters)
             {
-                _threads.erase(_threads.find(std::this_thread::get_id()));
-                --_size;
+                counters->in_use = false;
+            }
+
+            auto it = _threads.find(std::this_thread::get_id());
+            _exited.push_back(std::move(it->second));
+            _threads.erase(it);
+            --_size;
 
-                return true;
+            if (_size == _target)
+            {
+                completed.take(_resized);
             }
 
-            return false;
+            if (_draining && !_size)
+            {
+                _end = true;
+                _drained(completed);
+            }
+        }
+
+        // joins the workers that have exited; they don't touch the pool after releasing _lock for the last time, so this
+        // doesn't block for long
+        void _reap()
+        {
+            for (auto && th : _exited)
+            {
+                if (th.joinable() && th.get_id() != std::this_thread::get_id())
+                {
+                    th.join();
+                }
+            }
+            _exited.clear();
         }
 
+        // must be called with _lock held
         void _spawn()
         {
-            detaching_thread t{ &thread_pool::_loop, this };
+            _reap();
+
+            _worker_counters * counters = nullptr;
+
+            if (_statistics)
+            {
+                // a new worker continues counting where an exited one left off, so that the totals stay cumulative
+                auto it = std::find_if(_counters.begin(), _counters.end(), [](auto && counters){ return !counters->in_use; });
+                if (it == _counters.end())
+                {
+                    _counters.push_back(std::make_unique<_worker_counters>());
+                    it = std::prev(_counters.end());
+                }
+
+                counters = it->get();
+                counters->in_use = true;
+            }
+
+            detaching_thread t{ &thread_pool::_loop, this, counters };
             auto id = t.get_id();
             _threads[id] = std::move(t);
             ++_size;
@@ -251,16 +1062,72 @@ namespace reaver { inline namespace _v1
 
         std::atomic<std::size_t> _size{ 0 };
 
+        idle_policy _policy;
+        std::vector<std::size_t> _cpus;
+        elastic_policy _elastic;
+        // guarded by _lock
+        std::size_t _target = 0;
+        std::vector<function<void ()>> _resized;
+        std::vector<detaching_thread> _exited;
+        std::size_t _capacity;
+        overflow_policy _overflow;
+        // the number of producers waiting in _admit; guarded by _lock
+        std::size_t _blocked = 0;
+        bool _statistics;
+        bool _same_worker;
+        // guarded by _lock
+        std::vector<std::unique_ptr<_worker_counters>> _counters;
+        // only modified under _lock; read without it by spinning workers
+        std::atomic<std::size_t> _queued{ 0 };
+        // guarded by _lock
+        std::size_t _parked = 0;
+
         std::map<std::thread::id, detaching_thread> _threads;
-        std::queue<function<void ()>> _queue;
+        // indexed by priority
+        std::array<std::queue<_task>, 3> _queues;
+        // for each lane, how many tasks were taken from higher lanes since the last time a task was taken from it
+        std::array<std::size_t, 3> _skipped{};
 
         std::condition_variable _cond;
+        std::condition_variable _not_full;
         std::mutex _lock;
 
-        semaphore _die_semaphore;
-
         std::atomic<bool> _end{ false };
+        // set by shutdown(); the workers exit once the queue is empty, and the last one to do so sets _end
+        std::atomic<bool> _draining{ false };
+        // guarded by _lock
+        std::chrono::steady_clock::time_point _deadline = std::chrono::steady_clock::time_point::max();
+        std::vector<function<void ()>> _shutdowns;
 
         callbacks<void (void)> _waiters;
     };
+
+    // a view of a single lane of a thread_pool, so that it can be used wherever an executor is expected, e.g. to pin
+    // a chain of continuations to a lane with then(sched, f)
+    class prioritized_executor : public executor
+    {
+    public:
+        prioritized_executor(std::shared_ptr<thread_pool> pool, priority lane) : _pool{ std::move(pool) }, _lane{ lane }
+        {
+        }
+
+        virtual void push(function<void ()> f) override
+        {
+            _pool->push(_lane, std::move(f));
+        }
+
+        virtual void push_bulk(std::vector<function<void ()>> tasks) override
+        {
+            _pool->push_bulk(_lane, std::move(tasks));
+        }
+
+        priority lane() const
+        {
+            return _lane;
+        }
+
+    private:
+        std::shared_ptr<thread_pool> _pool;
+        priority _lane;
+    };
 }}
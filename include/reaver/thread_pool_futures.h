@@ -0,0 +1,92 @@
+/**
+ * Reaver Library License
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+
+#pragma once
+
+#include "thread_pool.h"
+#include "future.h"
+
+namespace reaver { inline namespace _v1
+{
+    inline future<void> thread_pool::shutdown()
+    {
+        return shutdown(std::chrono::steady_clock::time_point::max());
+    }
+
+    inline future<void> thread_pool::shutdown(std::chrono::steady_clock::time_point deadline)
+    {
+        auto pair = make_promise<void>();
+
+        _completions completed;
+        std::unique_lock<std::mutex> lock{ _lock };
+
+        _deadline = std::min(_deadline, deadline);
+        _draining = true;
+
+        if (_end || !_size)
+        {
+            _drop_queued();
+            _end = true;
+            completed.add([promise = pair.promise]{ promise.set(); });
+            return std::move(pair.future);
+        }
+
+        _shutdowns.push_back([promise = pair.promise]{ promise.set(); });
+        _cond.notify_all();
+        _not_full.notify_all();
+
+        return std::move(pair.future);
+    }
+
+    template<typename Rep, typename Period>
+    future<void> thread_pool::shutdown(std::chrono::duration<Rep, Period> timeout)
+    {
+        return shutdown(std::chrono::steady_clock::now() + timeout);
+    }
+
+    inline future<void> thread_pool::resize(std::size_t new_size)
+    {
+        auto pair = make_promise<void>();
+
+        _completions completed;
+        std::unique_lock<std::mutex> lock{ _lock };
+
+        completed.take(_resized);
+
+        _target = new_size;
+        while (_size < _target)
+        {
+            _spawn();
+        }
+
+        if (_size == _target)
+        {
+            completed.add([promise = pair.promise]{ promise.set(); });
+            return std::move(pair.future);
+        }
+
+        _resized.push_back([promise = pair.promise]{ promise.set(); });
+        _cond.notify_all();
+
+        return std::move(pair.future);
+    }
+}}
@@ -0,0 +1,576 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+
+#pragma once
+
+#include <memory>
+#include <array>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <atomic>
+
+#include "executor.h"
+#include "future.h"
+#include "thread.h"
+#include "exception.h"
+
+namespace reaver { inline namespace _v1
+{
+    class future_timeout : public exception
+    {
+    public:
+        future_timeout() : exception{ logger::error }
+        {
+            *this << "a future has not become ready before its deadline.";
+        }
+    };
+
+    namespace _detail
+    {
+        struct _timer
+        {
+            _timer * prev = nullptr;
+            _timer * next = nullptr;
+            // the slot the timer is linked into, if any
+            _timer ** slot = nullptr;
+            // the wheel's reference to the timer, held while it's linked
+            std::shared_ptr<_timer> self;
+
+            std::uint64_t expiry;
+            // in ticks; 0 for timers that fire once
+            std::uint64_t period;
+            bool cancelled = false;
+
+            std::shared_ptr<function<void ()>> f;
+        };
+
+        // a hierarchical timing wheel: level l has 64 slots, each spanning 64^l ticks
+        // a timer goes to the lowest level at which its expiry and the current tick only differ in that level's slot; once
+        // the current tick reaches the start of that slot, the timer is moved (cascaded) to a lower level, until it
+        // reaches level 0 and fires; insertion and removal are O(1), and each timer is cascaded at most `levels` times
+        struct _timer_wheel
+        {
+            static constexpr std::size_t bits = 6;
+            static constexpr std::size_t slots = 1 << bits;
+            // with a 1ms resolution, enough for timers over two years into the future
+            static constexpr std::size_t levels = 6;
+
+            ~_timer_wheel()
+            {
+                for (auto && level : wheel)
+                {
+                    for (auto && slot : level)
+                    {
+                        while (slot)
+                        {
+                            remove(slot);
+                        }
+                    }
+                }
+            }
+
+            // must be called with lock held; the timer must expire after the current tick
+            void insert(std::shared_ptr<_timer> timer)
+            {
+                auto diff = timer->expiry ^ tick;
+                std::size_t level = 0;
+                while (level + 1 < levels && diff >> (bits * (level + 1)))
+                {
+                    ++level;
+                }
+
+                std::size_t index;
+                if (diff >> (bits * levels))
+                {
+                    // beyond the range of the wheel; park it in the slot cascaded last, it'll be reinserted from there
+                    index = ((tick >> (bits * level)) + slots - 1) & (slots - 1);
+                }
+
+                else
+                {
+                    index = (timer->expiry >> (bits * level)) & (slots - 1);
+                }
+
+                auto & slot = wheel[level][index];
+                timer->slot = &slot;
+                timer->prev = nullptr;
+                timer->next = slot;
+                if (slot)
+                {
+                    slot->prev = timer.get();
+                }
+                slot = timer.get();
+                slot->self = std::move(timer);
+
+                ++count;
+            }
+
+            // must be called with lock held
+            void remove(_timer * timer)
+            {
+                if (!timer->slot)
+                {
+                    return;
+                }
+
+                if (timer->prev)
+                {
+                    timer->prev->next = timer->next;
+                }
+                else
+                {
+                    *timer->slot = timer->next;
+                }
+
+                if (timer->next)
+                {
+                    timer->next->prev = timer->prev;
+                }
+
+                timer->prev = nullptr;
+                timer->next = nullptr;
+                timer->slot = nullptr;
+                --count;
+
+                // may destroy the timer
+                auto self = std::move(timer->self);
+            }
+
+            // must be called with lock held
+            // moves the wheel forward by one tick, and appends the timers that fire to `fired`
+            void advance(std::vector<std::shared_ptr<_timer>> & fired)
+            {
+                ++tick;
+
+                for (std::size_t level = 1; level < levels; ++level)
+                {
+                    if (tick & ((std::uint64_t{ 1 } << (bits * level)) - 1))
+                    {
+                        break;
+                    }
+
+                    auto & slot = wheel[level][(tick >> (bits * level)) & (slots - 1)];
+                    while (slot)
+                    {
+                        auto timer = slot->self;
+                        remove(timer.get());
+
+                        if (timer->expiry <= tick)
+                        {
+                            fired.push_back(std::move(timer));
+                        }
+
+                        else
+                        {
+                            insert(std::move(timer));
+                        }
+                    }
+                }
+
+                auto & slot = wheel[0][tick & (slots - 1)];
+                while (slot)
+                {
+                    auto timer = slot->self;
+                    remove(timer.get());
+                    fired.push_back(std::move(timer));
+                }
+            }
+
+            std::mutex lock;
+            std::uint64_t tick = 0;
+            std::size_t count = 0;
+            std::array<std::array<_timer *, slots>, levels> wheel{};
+        };
+    }
+
+    class timer_handle
+    {
+    public:
+        timer_handle() = default;
+
+        timer_handle(std::weak_ptr<_detail::_timer_wheel> wheel, std::weak_ptr<_detail::_timer> timer) : _wheel{ std::move(wheel) }, _timer{ std::move(timer) }
+        {
+        }
+
+        // returns true if the timer was still pending; a periodic timer won't fire again after this returns, but a run
+        // that was already dispatched to the target executor isn't stopped
+        bool cancel()
+        {
+            auto wheel = _wheel.lock();
+            auto timer = _timer.lock();
+            if (!wheel || !timer)
+            {
+                return false;
+            }
+
+            std::unique_lock<std::mutex> lock{ wheel->lock };
+
+            timer->cancelled = true;
+            if (!timer->slot)
+            {
+                return false;
+            }
+
+            wheel->remove(timer.get());
+            return true;
+        }
+
+    private:
+        std::weak_ptr<_detail::_timer_wheel> _wheel;
+        std::weak_ptr<_detail::_timer> _timer;
+    };
+
+    // runs tasks at or after given points in time, on a target executor (the default executor, unless specified
+    // otherwise), with a single thread driving a timing wheel; tasks fire at most one resolution late, unless the target
+    // executor is busy
+    // pushing a task directly forwards it to the target executor right away
+    // timers that haven't fired by the time the timer_executor is destroyed are dropped
+    class timer_executor : public executor
+    {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        timer_executor(std::shared_ptr<executor> target = nullptr, std::chrono::milliseconds resolution = std::chrono::milliseconds{ 1 })
+            : _target{ target ? std::move(target) : default_executor() }, _resolution{ resolution.count() > 0 ? resolution : std::chrono::milliseconds{ 1 } },
+            _start{ clock::now() }, _wheel{ std::make_shared<_detail::_timer_wheel>() }, _thread{ &timer_executor::_loop, this }
+        {
+        }
+
+        ~timer_executor()
+        {
+            {
+                std::unique_lock<std::mutex> lock{ _wheel->lock };
+                _end = true;
+            }
+
+            _cond.notify_all();
+            _thread.join();
+        }
+
+        virtual void push(function<void ()> f) override
+        {
+            _target->push(std::move(f));
+        }
+
+        timer_handle schedule_at(clock::time_point time, function<void ()> f)
+        {
+            return _schedule(time, 0, std::move(f));
+        }
+
+        template<typename Rep, typename Period>
+        timer_handle schedule_after(std::chrono::duration<Rep, Period> delay, function<void ()> f)
+        {
+            return schedule_at(clock::now() + delay, std::move(f));
+        }
+
+        // runs f every `period`, starting one period from now, until the returned handle is cancelled
+        template<typename Rep, typename Period>
+        timer_handle schedule_every(std::chrono::duration<Rep, Period> period, function<void ()> f)
+        {
+            auto ticks = std::max<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(period) / _resolution, 1);
+            return _schedule(clock::now() + period, ticks, std::move(f));
+        }
+
+        // the returned future becomes ready once the delay has passed
+        template<typename Rep, typename Period>
+        future<> make_timeout_future(std::chrono::duration<Rep, Period> delay)
+        {
+            auto pair = make_promise<void>();
+            schedule_after(delay, [promise = std::move(pair.promise)]{ promise.set(); });
+            return std::move(pair.future);
+        }
+
+        std::size_t pending() const
+        {
+            std::unique_lock<std::mutex> lock{ _wheel->lock };
+            return _wheel->count;
+        }
+
+    private:
+        // rounds up, so that timers never fire early
+        std::uint64_t _to_tick(clock::time_point time) const
+        {
+            if (time <= _start)
+            {
+                return 0;
+            }
+
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(time - _start);
+            auto resolution = std::chrono::duration_cast<std::chrono::nanoseconds>(_resolution);
+            return (elapsed.count() + resolution.count() - 1) / resolution.count();
+        }
+
+        // the last tick that has already started
+        std::uint64_t _current_tick() const
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - _start) / std::chrono::duration_cast<std::chrono::nanoseconds>(_resolution);
+        }
+
+        timer_handle _schedule(clock::time_point time, std::uint64_t period, function<void ()> f)
+        {
+            auto timer = std::make_shared<_detail::_timer>();
+            timer->expiry = _to_tick(time);
+            timer->period = period;
+            timer->f = std::make_shared<function<void ()>>(std::move(f));
+
+            timer_handle handle{ _wheel, timer };
+
+            {
+                std::unique_lock<std::mutex> lock{ _wheel->lock };
+
+                if (!_wheel->count)
+                {
+                    // the driving thread doesn't tick while the wheel is empty; catch up
+                    _wheel->tick = std::max(_wheel->tick, _current_tick());
+                }
+
+                auto was_empty = !_wheel->count;
+                auto due = timer->expiry <= _wheel->tick;
+
+                if (due && period)
+                {
+                    timer->expiry = _wheel->tick + period;
+                }
+
+                if (!due || period)
+                {
+                    _wheel->insert(timer);
+
+                    if (was_empty)
+                    {
+                        _cond.notify_one();
+                    }
+                }
+
+                if (!due)
+                {
+                    return handle;
+                }
+            }
+
+            _target->push(_task(*timer));
+            return handle;
+        }
+
+        static function<void ()> _task(_detail::_timer & timer)
+        {
+            if (timer.period)
+            {
+                return [f = timer.f]{ (*f)(); };
+            }
+
+            return std::move(*timer.f);
+        }
+
+        void _loop()
+        {
+            std::vector<std::shared_ptr<_detail::_timer>> fired;
+            std::vector<function<void ()>> tasks;
+
+            std::unique_lock<std::mutex> lock{ _wheel->lock };
+
+            while (!_end)
+            {
+                if (!_wheel->count)
+                {
+                    _cond.wait(lock);
+                    continue;
+                }
+
+                _cond.wait_until(lock, _start + _resolution * (_wheel->tick + 1));
+
+                auto now = _current_tick();
+                while (_wheel->count && _wheel->tick < now)
+                {
+                    _wheel->advance(fired);
+                }
+
+                if (!_wheel->count)
+                {
+                    _wheel->tick = std::max(_wheel->tick, now);
+                }
+
+                for (auto && timer : fired)
+                {
+                    tasks.push_back(_task(*timer));
+
+                    if (timer->period && !timer->cancelled)
+                    {
+                        timer->expiry += timer->period;
+                        if (timer->expiry <= _wheel->tick)
+                        {
+                            // fell behind; skip the missed runs instead of firing them all at once
+                            timer->expiry = _wheel->tick + 1;
+                        }
+                        _wheel->insert(std::move(timer));
+                    }
+                }
+                fired.clear();
+
+                if (tasks.size())
+                {
+                    lock.unlock();
+                    _target->push_bulk(std::move(tasks));
+                    tasks.clear();
+                    lock.lock();
+                }
+            }
+        }
+
+        std::shared_ptr<executor> _target;
+        std::chrono::milliseconds _resolution;
+        clock::time_point _start;
+
+        std::shared_ptr<_detail::_timer_wheel> _wheel;
+        std::condition_variable _cond;
+        // guarded by _wheel->lock
+        bool _end = false;
+
+        joining_thread _thread;
+    };
+
+    // created on first use, firing on the default executor
+    inline std::shared_ptr<timer_executor> default_timer_executor()
+    {
+        static auto timers = std::make_shared<timer_executor>();
+        return timers;
+    }
+
+    namespace _detail
+    {
+        // whichever of the input and the timer comes first decides; it then releases the other one, so that neither the
+        // timer entry nor the observer of the input outlive the race
+        template<typename T>
+        struct _timeout_state
+        {
+            _timeout_state(manual_promise<T> promise) : promise{ std::move(promise) }
+            {
+            }
+
+            // returns true if the caller won
+            bool decide()
+            {
+                if (decided.exchange(true))
+                {
+                    return false;
+                }
+
+                timer_handle released_timer;
+                optional<future<>> released_observer;
+
+                {
+                    std::lock_guard<std::mutex> guard{ lock };
+                    released_timer = std::move(timer);
+                    released_observer = std::move(observer);
+                    observer = none;
+                }
+
+                released_timer.cancel();
+                return true;
+            }
+
+            manual_promise<T> promise;
+            std::atomic<bool> decided{ false };
+
+            std::mutex lock;
+            timer_handle timer;
+            optional<future<>> observer;
+        };
+    }
+
+    // resolves with the value or the exception of the input, or fails with future_timeout if the input isn't ready
+    // by the deadline
+    template<typename T>
+    future<T> timeout(std::shared_ptr<timer_executor> timers, future<T> input, std::chrono::steady_clock::time_point deadline)
+    {
+        auto pair = make_promise<T>();
+        // allocated apart from the control block, which the weak reference of the observer keeps around
+        std::shared_ptr<_detail::_timeout_state<T>> state{ new _detail::_timeout_state<T>{ std::move(pair.promise) } };
+
+        auto timer = timers->schedule_at(deadline, [state]{
+            if (state->decide())
+            {
+                state->promise.set(std::make_exception_ptr(future_timeout{}));
+            }
+        });
+
+        {
+            std::lock_guard<std::mutex> guard{ state->lock };
+            if (!state->decided)
+            {
+                state->timer = std::move(timer);
+            }
+        }
+
+        // the observer only holds a weak reference; the timer entry keeps the state alive until it's decided, and if the
+        // timer wins, the node left attached to the input is inert and doesn't keep the state around
+        std::weak_ptr<_detail::_timeout_state<T>> weak_state = state;
+        auto observer = _detail::_observe(input,
+            [weak_state](auto value) {
+                auto state = weak_state.lock();
+                if (state && state->decide())
+                {
+                    state->promise.set(std::move(value));
+                }
+            },
+
+            [weak_state](std::exception_ptr exception) {
+                auto state = weak_state.lock();
+                if (state && state->decide())
+                {
+                    state->promise.set(exception);
+                }
+            }
+        );
+
+        {
+            std::lock_guard<std::mutex> guard{ state->lock };
+            if (!state->decided)
+            {
+                state->observer = std::move(observer);
+            }
+        }
+
+        return std::move(pair.future);
+    }
+
+    template<typename T, typename Rep, typename Period>
+    future<T> timeout(std::shared_ptr<timer_executor> timers, future<T> input, std::chrono::duration<Rep, Period> duration)
+    {
+        return timeout(std::move(timers), std::move(input), std::chrono::steady_clock::now() + duration);
+    }
+
+    template<typename T>
+    future<T> timeout(future<T> input, std::chrono::steady_clock::time_point deadline)
+    {
+        return timeout(default_timer_executor(), std::move(input), deadline);
+    }
+
+    template<typename T, typename Rep, typename Period>
+    future<T> timeout(future<T> input, std::chrono::duration<Rep, Period> duration)
+    {
+        return timeout(default_timer_executor(), std::move(input), duration);
+    }
+}}
@@ -43,9 +43,9 @@ namespace reaver { inline namespace _v1
     {
 #ifdef __unix__
         using _handle = pthread_key_t;
-        inline void _initialize(_handle & h)
+        inline void _initialize(_handle & h, void (*cleanup)(void *))
         {
-            if (pthread_key_create(&h, nullptr))
+            if (pthread_key_create(&h, cleanup))
             {
                 throw tls_creation_exception{};
             }
@@ -70,9 +70,10 @@ namespace reaver { inline namespace _v1
         static_assert(sizeof(T) <= sizeof(void *), "tls_variable is currently only available for types of sizes up to the size of `void *`.");
         static_assert(std::is_trivially_destructible<T>::value && std::is_trivial<T>::value, "tls_variable is currently only available for trivial types.");
 
-        tls_variable(T initial = T{})
+        // cleanup, if provided, is called with the thread's value when a thread that set it to non-null exits
+        tls_variable(T initial = T{}, void (*cleanup)(void *) = nullptr)
         {
-            _detail::_initialize(_handle);
+            _detail::_initialize(_handle, cleanup);
             *this = initial;
         }
 
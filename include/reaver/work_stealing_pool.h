@@ -0,0 +1,452 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <cstdint>
+
+#include "executor.h"
+#include "thread.h"
+#include "tls.h"
+#include "thread_pool.h"
+
+namespace reaver { inline namespace _v1
+{
+    namespace _detail
+    {
+        // Chase-Lev deque, with memory orderings taken from "Correct and Efficient Work-Stealing for Weak Memory Models"
+        // only the owning thread may push() and take(); any thread may steal()
+        // old buffers are kept around until the deque dies, since a thief may still be reading from them
+        template<typename T>
+        class _work_stealing_deque
+        {
+            class _buffer
+            {
+            public:
+                _buffer(std::int64_t size) : _size{ size }, _elements{ new std::atomic<T *>[size] }
+                {
+                }
+
+                std::int64_t size() const
+                {
+                    return _size;
+                }
+
+                T * get(std::int64_t i) const
+                {
+                    return _elements[i & (_size - 1)].load(std::memory_order_relaxed);
+                }
+
+                void put(std::int64_t i, T * t)
+                {
+                    _elements[i & (_size - 1)].store(t, std::memory_order_relaxed);
+                }
+
+            private:
+                std::int64_t _size;
+                std::unique_ptr<std::atomic<T *>[]> _elements;
+            };
+
+        public:
+            _work_stealing_deque(std::int64_t initial_size = 64)
+            {
+                _buffers.push_back(std::make_unique<_buffer>(initial_size));
+                _current.store(_buffers.back().get(), std::memory_order_relaxed);
+            }
+
+            _work_stealing_deque(const _work_stealing_deque &) = delete;
+            _work_stealing_deque & operator=(const _work_stealing_deque &) = delete;
+
+            void push(T * t)
+            {
+                auto bottom = _bottom.load(std::memory_order_relaxed);
+                auto top = _top.load(std::memory_order_acquire);
+                auto buffer = _current.load(std::memory_order_relaxed);
+
+                if (bottom - top > buffer->size() - 1)
+                {
+                    _buffers.push_back(std::make_unique<_buffer>(buffer->size() * 2));
+
+                    for (auto i = top; i != bottom; ++i)
+                    {
+                        _buffers.back()->put(i, buffer->get(i));
+                    }
+
+                    buffer = _buffers.back().get();
+                    _current.store(buffer, std::memory_order_release);
+                }
+
+                buffer->put(bottom, t);
+                std::atomic_thread_fence(std::memory_order_release);
+                _bottom.store(bottom + 1, std::memory_order_relaxed);
+            }
+
+            T * take()
+            {
+                auto bottom = _bottom.load(std::memory_order_relaxed) - 1;
+                auto buffer = _current.load(std::memory_order_relaxed);
+                _bottom.store(bottom, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                auto top = _top.load(std::memory_order_relaxed);
+
+                if (top > bottom)
+                {
+                    _bottom.store(bottom + 1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+
+                auto ret = buffer->get(bottom);
+
+                if (top == bottom)
+                {
+                    // last element; race the thieves for it
+                    if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    {
+                        ret = nullptr;
+                    }
+
+                    _bottom.store(bottom + 1, std::memory_order_relaxed);
+                }
+
+                return ret;
+            }
+
+            // returns nullptr both when the deque is empty and when the race for the top element was lost
+            T * steal()
+            {
+                auto top = _top.load(std::memory_order_acquire);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                auto bottom = _bottom.load(std::memory_order_acquire);
+
+                if (top >= bottom)
+                {
+                    return nullptr;
+                }
+
+                auto ret = _current.load(std::memory_order_acquire)->get(top);
+                if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                {
+                    return nullptr;
+                }
+
+                return ret;
+            }
+
+            bool empty() const
+            {
+                return _bottom.load(std::memory_order_acquire) <= _top.load(std::memory_order_acquire);
+            }
+
+        private:
+            std::atomic<std::int64_t> _top{ 0 };
+            std::atomic<std::int64_t> _bottom{ 0 };
+            std::atomic<_buffer *> _current;
+
+            std::vector<std::unique_ptr<_buffer>> _buffers;
+        };
+    }
+
+    // an executor with a deque per worker; tasks pushed from within a worker land in that worker's deque
+    // and are taken in LIFO order, idle workers steal from the other end of their siblings' deques,
+    // and tasks pushed from outside of the pool go through a separate, shared injection queue
+    class work_stealing_pool : public executor
+    {
+        struct _worker
+        {
+            work_stealing_pool * owner;
+            std::size_t index;
+            std::uint32_t seed;
+
+            _detail::_work_stealing_deque<function<void ()>> deque;
+        };
+
+        using _task = std::unique_ptr<function<void ()>>;
+
+    public:
+        work_stealing_pool(std::size_t size)
+        {
+            _workers.reserve(size);
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                _workers.emplace_back(new _worker{ this, i, static_cast<std::uint32_t>(i * 2654435761u + 1) });
+            }
+
+            _threads.reserve(size);
+            for (auto & worker : _workers)
+            {
+                _threads.emplace_back(&work_stealing_pool::_loop, this, std::ref(*worker));
+            }
+        }
+
+        ~work_stealing_pool()
+        {
+            {
+                std::unique_lock<std::mutex> lock{ _sleep_lock };
+                _end = true;
+                _wake.notify_all();
+            }
+
+            for (auto & th : _threads)
+            {
+                try
+                {
+                    if (th.joinable())
+                    {
+                        th.join();
+                    }
+                }
+
+                catch (...)
+                {
+                }
+            }
+
+            for (auto & worker : _workers)
+            {
+                while (_task{ worker->deque.take() })
+                {
+                }
+            }
+
+            for (auto task : _injection)
+            {
+                delete task;
+            }
+        }
+
+        virtual void push(function<void ()> f) override
+        {
+            auto task = std::make_unique<function<void ()>>(std::move(f));
+            _worker * current = _current_worker();
+
+            if (current && current->owner == this)
+            {
+                current->deque.push(task.release());
+            }
+
+            else
+            {
+                std::lock_guard<std::mutex> lock{ _injection_lock };
+
+                if (_end)
+                {
+                    throw thread_pool_closed{};
+                }
+
+                _injection.push_back(task.release());
+            }
+
+            _notify();
+        }
+
+        virtual void push_bulk(std::vector<function<void ()>> tasks) override
+        {
+            if (tasks.empty())
+            {
+                return;
+            }
+
+            std::vector<_task> owned;
+            owned.reserve(tasks.size());
+            for (auto && task : tasks)
+            {
+                owned.push_back(std::make_unique<function<void ()>>(std::move(task)));
+            }
+
+            _worker * current = _current_worker();
+
+            if (current && current->owner == this)
+            {
+                for (auto && task : owned)
+                {
+                    current->deque.push(task.release());
+                }
+            }
+
+            else
+            {
+                std::lock_guard<std::mutex> lock{ _injection_lock };
+
+                if (_end)
+                {
+                    throw thread_pool_closed{};
+                }
+
+                for (auto && task : owned)
+                {
+                    _injection.push_back(task.release());
+                }
+            }
+
+            _notify(owned.size());
+        }
+
+        std::size_t size() const
+        {
+            return _workers.size();
+        }
+
+    private:
+        static tls_variable<_worker *> & _current_worker()
+        {
+            static tls_variable<_worker *> current{ nullptr };
+            return current;
+        }
+
+        void _notify(std::size_t count = 1)
+        {
+            // pairs with the increment of _sleeping in _loop; either the sleeper sees the new task,
+            // or we see the sleeper
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            auto sleeping = _sleeping.load(std::memory_order_relaxed);
+            if (sleeping)
+            {
+                std::unique_lock<std::mutex> lock{ _sleep_lock };
+
+                if (count >= sleeping)
+                {
+                    _wake.notify_all();
+                    return;
+                }
+
+                while (count--)
+                {
+                    _wake.notify_one();
+                }
+            }
+        }
+
+        _task _find_task(_worker & self)
+        {
+            if (auto task = self.deque.take())
+            {
+                return _task{ task };
+            }
+
+            {
+                std::lock_guard<std::mutex> lock{ _injection_lock };
+
+                if (!_injection.empty())
+                {
+                    auto task = _injection.front();
+                    _injection.pop_front();
+                    return _task{ task };
+                }
+            }
+
+            // xorshift; only needs to be good enough to spread the thieves around
+            self.seed ^= self.seed << 13;
+            self.seed ^= self.seed >> 17;
+            self.seed ^= self.seed << 5;
+
+            auto start = self.seed % _workers.size();
+            for (std::size_t i = 0; i < _workers.size(); ++i)
+            {
+                auto & victim = *_workers[(start + i) % _workers.size()];
+                if (&victim == &self)
+                {
+                    continue;
+                }
+
+                if (auto task = victim.deque.steal())
+                {
+                    return _task{ task };
+                }
+            }
+
+            return nullptr;
+        }
+
+        bool _has_work()
+        {
+            {
+                std::lock_guard<std::mutex> lock{ _injection_lock };
+
+                if (!_injection.empty())
+                {
+                    return true;
+                }
+            }
+
+            for (auto & worker : _workers)
+            {
+                if (!worker->deque.empty())
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void _loop(_worker & self)
+        {
+            _current_worker() = &self;
+
+            while (true)
+            {
+                if (auto task = _find_task(self))
+                {
+                    (*task)();
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock{ _sleep_lock };
+                _sleeping.fetch_add(1, std::memory_order_seq_cst);
+
+                if (!_has_work())
+                {
+                    if (_end)
+                    {
+                        --_sleeping;
+                        break;
+                    }
+
+                    _wake.wait(lock);
+                }
+
+                --_sleeping;
+            }
+
+            _current_worker() = nullptr;
+        }
+
+        std::vector<std::unique_ptr<_worker>> _workers;
+        std::vector<joining_thread> _threads;
+
+        std::mutex _injection_lock;
+        std::deque<function<void ()> *> _injection;
+
+        std::mutex _sleep_lock;
+        std::condition_variable _wake;
+        std::atomic<std::size_t> _sleeping{ 0 };
+
+        std::atomic<bool> _end{ false };
+    };
+}}
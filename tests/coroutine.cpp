@@ -0,0 +1,133 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+
+#include <reaver/mayfly.h>
+
+#include <queue>
+#include <future>
+#include <thread>
+
+#ifdef __cpp_impl_coroutine
+#include <coroutine>
+#endif
+
+#include <boost/functional/hash.hpp>
+
+namespace test
+{
+#   include "future.h"
+#   include "coroutine.h"
+}
+
+#ifdef __cpp_impl_coroutine
+
+namespace
+{
+    test::reaver::future<int> add_one(test::reaver::future<int> input)
+    {
+        co_return co_await input + 1;
+    }
+
+    test::reaver::future<> check_thread(test::reaver::future<> input, std::thread::id & resumed_on)
+    {
+        co_await input;
+        resumed_on = std::this_thread::get_id();
+    }
+
+    test::reaver::future<> check_thread_on(std::shared_ptr<test::reaver::executor> sched, test::reaver::future<> input, std::thread::id & resumed_on)
+    {
+        co_await test::reaver::resume_on(std::move(sched), std::move(input));
+        resumed_on = std::this_thread::get_id();
+    }
+
+    test::reaver::future<int> rethrow(test::reaver::future<int> input)
+    {
+        try
+        {
+            co_return co_await input;
+        }
+
+        catch (std::runtime_error &)
+        {
+            co_return -1;
+        }
+    }
+
+    test::reaver::future<int> throw_away()
+    {
+        throw std::runtime_error{ "oops" };
+        co_return 0;
+    }
+}
+
+MAYFLY_BEGIN_SUITE("coroutines");
+
+MAYFLY_ADD_TESTCASE("awaiting ready futures", []()
+{
+    // nothing suspends, so the coroutine runs to completion before returning
+    auto future = add_one(test::reaver::make_ready_future(1));
+    MAYFLY_REQUIRE(future.is_ready());
+    MAYFLY_CHECK(future.get() == 2);
+});
+
+MAYFLY_ADD_TESTCASE("awaiting pending futures", []()
+{
+    auto pair = test::reaver::make_promise<int>();
+    auto future = add_one(std::move(pair.future));
+    MAYFLY_CHECK(!future.is_ready());
+
+    pair.promise.set(41);
+    MAYFLY_CHECK(future.get() == 42);
+});
+
+MAYFLY_ADD_TESTCASE("resuming on an executor", []()
+{
+    auto pool = std::make_shared<test::reaver::thread_pool>(1);
+    auto pool_thread = pool->push([]{ return std::this_thread::get_id(); }).get();
+
+    auto pair = test::reaver::make_promise<void>();
+    std::thread::id resumed_on;
+    auto future = check_thread_on(pool, std::move(pair.future), resumed_on);
+
+    pair.promise.set();
+    future.get();
+    MAYFLY_CHECK(resumed_on == pool_thread);
+
+    // a manual promise has no scheduler; the coroutine is resumed by the thread that sets it
+    auto manual = test::reaver::make_promise<void>();
+    auto checked = check_thread(std::move(manual.future), resumed_on);
+    manual.promise.set();
+    checked.get();
+    MAYFLY_CHECK(resumed_on == std::this_thread::get_id());
+});
+
+MAYFLY_ADD_TESTCASE("exceptions", []()
+{
+    auto future = rethrow(test::reaver::make_exceptional_future<int>(std::runtime_error{ "oops" }));
+    MAYFLY_CHECK(future.get() == -1);
+
+    MAYFLY_REQUIRE_THROWS_TYPE(std::runtime_error, throw_away().get());
+});
+
+MAYFLY_END_SUITE;
+
+#endif
@@ -22,6 +22,9 @@
 
 #include <reaver/mayfly.h>
 
+#include <memory>
+#include <array>
+
 namespace test
 {
 #   include "function.h"
@@ -118,6 +121,50 @@ MAYFLY_ADD_TESTCASE("copy constructor", []()
 
 MAYFLY_ADD_TESTCASE("move constructor", []()
 {
+    auto destroyed = std::make_shared<int>(0);
+
+    struct counter
+    {
+        counter(std::shared_ptr<int> destroyed) : destroyed{ std::move(destroyed) }
+        {
+        }
+
+        counter(counter && other) noexcept = default;
+
+        ~counter()
+        {
+            if (destroyed)
+            {
+                ++*destroyed;
+            }
+        }
+
+        std::shared_ptr<int> destroyed;
+    };
+
+    {
+        // small enough to be stored in place
+        test::reaver::function<int ()> f = [c = counter{ destroyed }, i = 1]() mutable { return i++; };
+        MAYFLY_CHECK(f() == 1);
+
+        auto g = std::move(f);
+        MAYFLY_CHECK(g() == 2);
+        MAYFLY_CHECK(*destroyed == 0);
+    }
+
+    MAYFLY_CHECK(*destroyed == 1);
+
+    {
+        // too big to be stored in place
+        test::reaver::function<int ()> f = [c = counter{ destroyed }, padding = std::array<char, 128>{ { 1 } }]() { return padding[0]; };
+        MAYFLY_CHECK(f() == 1);
+
+        auto g = std::move(f);
+        MAYFLY_CHECK(g() == 1);
+        MAYFLY_CHECK(*destroyed == 1);
+    }
+
+    MAYFLY_CHECK(*destroyed == 2);
 });
 
 MAYFLY_END_SUITE;
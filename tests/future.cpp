@@ -414,6 +414,56 @@ MAYFLY_ADD_TESTCASE("shared void future", []()
     }
 });
 
+MAYFLY_ADD_TESTCASE("inline continuations", []()
+{
+    {
+        auto future = test::reaver::make_ready_future(1).then_inline([](int i){ return i + 1; });
+        MAYFLY_CHECK(future.try_get() == 2);
+    }
+
+    {
+        auto pair = test::reaver::make_promise<int>();
+        auto future = pair.future.then_inline([](int i){ return i + 1; });
+
+        MAYFLY_CHECK(!future.try_get());
+        pair.promise.set(1);
+        MAYFLY_CHECK(future.try_get() == 2);
+    }
+
+    {
+        // past the depth limit, continuations go through the scheduler instead of growing the stack
+        auto pair = test::reaver::package([](){ return 0; });
+        auto future = pair.future;
+
+        for (auto i = 0; i < 10000; ++i)
+        {
+            future = future.then(test::reaver::inline_, [](int i){ return i + 1; });
+        }
+
+        auto exec = test::reaver::make_executor<trivial_executor>();
+        exec->push([exec, task = std::move(pair.packaged_task)](){ task(exec); });
+
+        MAYFLY_CHECK(future.try_get() == 10000);
+    }
+});
+
+MAYFLY_ADD_TESTCASE("continuations on a draining pool", []()
+{
+    auto pool = std::make_shared<test::reaver::thread_pool>(1);
+
+    std::promise<void> go;
+    auto blocker = go.get_future().share();
+
+    auto future = test::reaver::async(std::shared_ptr<test::reaver::executor>{ pool }, [blocker]{ blocker.wait(); return 1; });
+    auto continued = future.then([](int i){ return i + 1; });
+
+    auto drained = pool->shutdown();
+    go.set_value();
+    drained.get();
+
+    MAYFLY_CHECK(continued.try_get() == 2);
+});
+
 MAYFLY_END_SUITE;
 
 MAYFLY_ADD_TESTCASE("noncopyable value", []()
@@ -580,6 +630,324 @@ MAYFLY_ADD_TESTCASE("vector exception propagation", []()
     exec->push([exec, task = std::move(pair.packaged_task)](){ task(exec); });
 
     MAYFLY_REQUIRE_THROWS_TYPE(test::reaver::exception_list, final.try_get());
+
+    // inputs failing at the same time on different threads
+    auto pool = std::make_shared<test::reaver::thread_pool>(4);
+
+    for (auto i = 0; i < 50; ++i)
+    {
+        std::promise<void> go;
+        auto blocker = go.get_future().share();
+
+        std::vector<test::reaver::future<int>> futures;
+        for (auto j = 0; j < 8; ++j)
+        {
+            futures.push_back(test::reaver::async(pool, [blocker]() -> int { blocker.wait(); throw 1; }));
+        }
+
+        auto final = test::reaver::when_all(pool, futures);
+        go.set_value();
+
+        try
+        {
+            final.get();
+            MAYFLY_CHECK(!"the aggregate future should have failed");
+        }
+
+        catch (test::reaver::exception_list & list)
+        {
+            MAYFLY_CHECK(list.size() == 8);
+        }
+    }
+});
+
+MAYFLY_ADD_TESTCASE("abort on first failure", []()
+{
+    auto exec = test::reaver::make_executor<trivial_executor>();
+
+    {
+        auto failing = test::reaver::package([](){ throw 1; });
+        auto straggler = test::reaver::package([](){ return 2; });
+
+        auto final = test::reaver::when_all(exec, test::reaver::exception_policy::abort_on_first_failure, std::move(failing.future), std::move(straggler.future));
+
+        exec->push([exec, task = std::move(failing.packaged_task)](){ task(exec); });
+
+        // decided without waiting for the straggler, and with the original exception
+        MAYFLY_CHECK_THROWS_TYPE(int, final.try_get());
+
+        exec->push([exec, task = std::move(straggler.packaged_task)](){ task(exec); });
+    }
+
+    {
+        auto first = test::reaver::package([](){ throw 1; });
+        auto second = test::reaver::package([](){ throw 2; });
+        auto straggler = test::reaver::package([](){});
+
+        auto futures = std::vector<test::reaver::future<>>{
+            std::move(first.future),
+            std::move(second.future),
+            std::move(straggler.future)
+        };
+
+        auto final = test::reaver::when_all(exec, test::reaver::exception_policy::abort_on_first_failure, futures);
+
+        exec->push([exec, task = std::move(first.packaged_task)](){ task(exec); });
+        exec->push([exec, task = std::move(second.packaged_task)](){ task(exec); });
+
+        try
+        {
+            final.try_get();
+            MAYFLY_CHECK(!"the aggregate future should have failed");
+        }
+
+        catch (int i)
+        {
+            MAYFLY_CHECK(i == 1);
+        }
+
+        exec->push([exec, task = std::move(straggler.packaged_task)](){ task(exec); });
+    }
+
+    {
+        auto pair1 = test::reaver::package([](){ return 1; });
+        auto pair2 = test::reaver::package([](){ return 2; });
+
+        auto futures = std::vector<test::reaver::future<int>>{ std::move(pair1.future), std::move(pair2.future) };
+        auto final = test::reaver::when_all(exec, test::reaver::exception_policy::abort_on_first_failure, futures);
+
+        exec->push([exec, task = std::move(pair1.packaged_task)](){ task(exec); });
+        exec->push([exec, task = std::move(pair2.packaged_task)](){ task(exec); });
+
+        MAYFLY_CHECK(final.try_get() == std::vector<int>{ 1, 2 });
+    }
+});
+
+MAYFLY_ADD_TESTCASE("stragglers don't keep the results alive", []()
+{
+    auto exec = test::reaver::make_executor<trivial_executor>();
+
+    {
+        auto value = std::make_shared<int>(1);
+        std::weak_ptr<int> observer = value;
+
+        auto done = test::reaver::package([value = std::move(value)]() mutable { return std::move(value); });
+        auto failing = test::reaver::package([](){ throw 2; });
+        auto straggler = test::reaver::package([](){ return 3; });
+
+        {
+            auto final = test::reaver::when_all(exec, test::reaver::exception_policy::abort_on_first_failure, std::move(done.future), std::move(failing.future), std::move(straggler.future));
+
+            exec->push([exec, task = std::move(done.packaged_task)](){ task(exec); });
+            exec->push([exec, task = std::move(failing.packaged_task)](){ task(exec); });
+
+            MAYFLY_CHECK_THROWS_TYPE(int, final.try_get());
+        }
+
+        MAYFLY_CHECK(observer.expired());
+
+        exec->push([exec, task = std::move(straggler.packaged_task)](){ task(exec); });
+    }
+
+    {
+        auto value = std::make_shared<int>(1);
+        std::weak_ptr<int> observer = value;
+
+        auto done = test::reaver::package([value = std::move(value)]() mutable { return std::move(value); });
+        auto failing = test::reaver::package([]() -> std::shared_ptr<int> { throw 2; });
+        auto straggler = test::reaver::package([](){ return std::make_shared<int>(3); });
+
+        {
+            auto futures = std::vector<test::reaver::future<std::shared_ptr<int>>>{
+                std::move(done.future),
+                std::move(failing.future),
+                std::move(straggler.future)
+            };
+
+            auto final = test::reaver::when_all(exec, test::reaver::exception_policy::abort_on_first_failure, futures);
+            futures.clear();
+
+            exec->push([exec, task = std::move(done.packaged_task)](){ task(exec); });
+            exec->push([exec, task = std::move(failing.packaged_task)](){ task(exec); });
+
+            MAYFLY_CHECK_THROWS_TYPE(int, final.try_get());
+        }
+
+        MAYFLY_CHECK(observer.expired());
+
+        exec->push([exec, task = std::move(straggler.packaged_task)](){ task(exec); });
+    }
+});
+
+MAYFLY_END_SUITE;
+
+MAYFLY_BEGIN_SUITE("when_any");
+
+MAYFLY_ADD_TESTCASE("when_any", []()
+{
+    auto exec = test::reaver::make_executor<trivial_executor>();
+
+    {
+        auto pair1 = test::reaver::package([](){ return 1; });
+        auto pair2 = test::reaver::package([](){ return 2; });
+        auto pair3 = test::reaver::package([](){ return 3; });
+
+        auto final = test::reaver::when_any(exec, std::move(pair1.future), std::move(pair2.future), std::move(pair3.future));
+        MAYFLY_CHECK(!final.try_get());
+
+        exec->push([exec, task = std::move(pair2.packaged_task)](){ task(exec); });
+        MAYFLY_CHECK(final.try_get() == std::make_pair(std::size_t{ 1 }, 2));
+
+        exec->push([exec, task = std::move(pair1.packaged_task)](){ task(exec); });
+        exec->push([exec, task = std::move(pair3.packaged_task)](){ task(exec); });
+    }
+
+    {
+        auto pair1 = test::reaver::package([](){ throw 1; });
+        auto pair2 = test::reaver::package([](){});
+
+        auto futures = std::vector<test::reaver::future<>>{ std::move(pair1.future), std::move(pair2.future) };
+        auto final = test::reaver::when_any(exec, futures);
+
+        // a failure doesn't decide the result while there is still an input that may succeed
+        exec->push([exec, task = std::move(pair1.packaged_task)](){ task(exec); });
+        MAYFLY_CHECK(!final.try_get());
+
+        exec->push([exec, task = std::move(pair2.packaged_task)](){ task(exec); });
+        MAYFLY_CHECK(final.try_get() == std::size_t{ 1 });
+    }
+
+    {
+        auto pair1 = test::reaver::package([]() -> int { throw 1; });
+        auto pair2 = test::reaver::package([]() -> int { throw 2; });
+
+        auto final = test::reaver::when_any(exec, std::move(pair1.future), std::move(pair2.future));
+
+        exec->push([exec, task = std::move(pair1.packaged_task)](){ task(exec); });
+        exec->push([exec, task = std::move(pair2.packaged_task)](){ task(exec); });
+
+        MAYFLY_CHECK_THROWS_TYPE(test::reaver::exception_list, final.try_get());
+    }
+});
+
+MAYFLY_ADD_TESTCASE("when_n", []()
+{
+    auto exec = test::reaver::make_executor<trivial_executor>();
+
+    {
+        std::vector<test::reaver::packaged_task<int>> tasks;
+        std::vector<test::reaver::future<int>> futures;
+
+        for (auto i = 0; i < 5; ++i)
+        {
+            auto pair = test::reaver::package([i](){ return i * 10; });
+            tasks.push_back(std::move(pair.packaged_task));
+            futures.push_back(std::move(pair.future));
+        }
+
+        auto final = test::reaver::when_n(exec, 3, futures);
+
+        for (auto i : { 4, 0 })
+        {
+            exec->push([exec, task = tasks[i]](){ task(exec); });
+        }
+
+        MAYFLY_CHECK(!final.try_get());
+
+        exec->push([exec, task = tasks[2]](){ task(exec); });
+
+        using indexed = std::pair<std::size_t, int>;
+        MAYFLY_CHECK(final.try_get() == std::vector<indexed>{ { 4, 40 }, { 0, 0 }, { 2, 20 } });
+    }
+
+    {
+        auto pair1 = test::reaver::package([](){ throw 1; });
+        auto pair2 = test::reaver::package([](){ throw 2; });
+        auto pair3 = test::reaver::package([](){});
+
+        auto futures = std::vector<test::reaver::future<>>{ std::move(pair1.future), std::move(pair2.future), std::move(pair3.future) };
+        auto final = test::reaver::when_n(exec, 2, futures);
+
+        exec->push([exec, task = std::move(pair1.packaged_task)](){ task(exec); });
+        MAYFLY_CHECK(!final.try_get());
+
+        // two of three can no longer succeed; no need to wait for the last one
+        exec->push([exec, task = std::move(pair2.packaged_task)](){ task(exec); });
+        MAYFLY_CHECK_THROWS_TYPE(test::reaver::exception_list, final.try_get());
+
+        exec->push([exec, task = std::move(pair3.packaged_task)](){ task(exec); });
+    }
+});
+
+MAYFLY_ADD_TESTCASE("concurrent failures", []()
+{
+    auto pool = std::make_shared<test::reaver::thread_pool>(4);
+
+    for (auto i = 0; i < 50; ++i)
+    {
+        std::promise<void> go;
+        auto blocker = go.get_future().share();
+
+        std::vector<test::reaver::future<int>> futures;
+        for (auto j = 0; j < 8; ++j)
+        {
+            futures.push_back(test::reaver::async(pool, [blocker]() -> int { blocker.wait(); throw 1; }));
+        }
+
+        // six of eight become impossible after the third failure, while the others are still failing
+        auto final = test::reaver::when_n(pool, 6, futures);
+        go.set_value();
+
+        try
+        {
+            final.get();
+            MAYFLY_CHECK(!"the aggregate future should have failed");
+        }
+
+        catch (test::reaver::exception_list & list)
+        {
+            MAYFLY_CHECK(list.size() == 3);
+        }
+    }
+});
+
+MAYFLY_ADD_TESTCASE("losers don't keep the results alive", []()
+{
+    auto exec = test::reaver::make_executor<trivial_executor>();
+
+    auto value = std::make_shared<int>(1);
+    std::weak_ptr<int> observer = value;
+
+    auto done = test::reaver::package([value = std::move(value)]() mutable { return std::move(value); });
+    std::vector<test::reaver::packaged_task<std::shared_ptr<int>>> failing;
+    auto straggler = test::reaver::package([](){ return std::make_shared<int>(3); });
+
+    {
+        std::vector<test::reaver::future<std::shared_ptr<int>>> futures{ std::move(done.future) };
+        for (auto i = 0; i < 3; ++i)
+        {
+            auto pair = test::reaver::package([]() -> std::shared_ptr<int> { throw 2; });
+            failing.push_back(std::move(pair.packaged_task));
+            futures.push_back(std::move(pair.future));
+        }
+        futures.push_back(std::move(straggler.future));
+
+        auto final = test::reaver::when_n(exec, 3, futures);
+        futures.clear();
+
+        exec->push([exec, task = std::move(done.packaged_task)](){ task(exec); });
+        for (auto && task : failing)
+        {
+            exec->push([exec, task = std::move(task)](){ task(exec); });
+        }
+
+        // three of five can no longer succeed; the value of the first one isn't needed anymore
+        MAYFLY_CHECK_THROWS_TYPE(test::reaver::exception_list, final.try_get());
+    }
+
+    MAYFLY_CHECK(observer.expired());
+
+    exec->push([exec, task = std::move(straggler.packaged_task)](){ task(exec); });
 });
 
 MAYFLY_END_SUITE;
@@ -811,5 +1179,382 @@ MAYFLY_ADD_TESTCASE("unwrap with default executor", []()
     }
 });
 
+MAYFLY_ADD_TESTCASE("unwrap a pending future", []()
+{
+    auto exec = test::reaver::make_executor<trivial_executor>();
+
+    {
+        auto pair = test::reaver::make_promise<int>();
+
+        auto fut1 = test::reaver::make_ready_future(123);
+        auto fut2 = fut1.then(exec, [inner = pair.future](auto) { return inner; });
+
+        MAYFLY_REQUIRE(!fut2.try_get());
+
+        pair.promise.set(246);
+        MAYFLY_REQUIRE(fut2.try_get() == 246);
+    }
+
+    {
+        auto pair = test::reaver::make_promise<int>();
+
+        auto fut1 = test::reaver::make_ready_future(123);
+        auto fut2 = fut1.then(test::reaver::inline_, [inner = pair.future](auto) { return inner; })
+            .then(exec, [](auto v){ return v + 1; });
+
+        pair.promise.set(std::make_exception_ptr(1));
+        MAYFLY_REQUIRE_THROWS_TYPE(int, fut2.try_get());
+    }
+
+    {
+        auto pair = test::reaver::make_promise<void>();
+
+        auto fut1 = test::reaver::make_ready_future();
+        auto fut2 = fut1.then(exec, [inner = pair.future]() { return inner; });
+
+        MAYFLY_REQUIRE(!fut2.try_get());
+
+        pair.promise.set();
+        MAYFLY_REQUIRE(fut2.try_get());
+    }
+
+    {
+        auto pair = test::reaver::make_promise<int>();
+
+        auto fut1 = test::reaver::make_ready_future(123);
+        auto fut2 = fut1.then(exec, [inner = pair.future](auto) { return inner; });
+
+        {
+            auto promise = std::move(pair.promise);
+        }
+
+        MAYFLY_REQUIRE_THROWS_TYPE(test::reaver::broken_promise, fut2.try_get());
+    }
+});
+
+MAYFLY_BEGIN_SUITE("waiting");
+
+MAYFLY_ADD_TESTCASE("get", []()
+{
+    {
+        auto ready = test::reaver::make_ready_future(1);
+        MAYFLY_REQUIRE(ready.get() == 1);
+    }
+
+    {
+        auto pair = test::reaver::make_promise<int>();
+
+        std::thread setter{ [promise = pair.promise]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            promise.set(123);
+        } };
+
+        MAYFLY_CHECK(pair.future.get() == 123);
+        setter.join();
+    }
+
+    {
+        auto pair = test::reaver::make_promise<void>();
+
+        std::thread setter{ [promise = pair.promise]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            promise.set();
+        } };
+
+        MAYFLY_CHECK_NOTHROW(pair.future.get());
+        setter.join();
+    }
+
+    {
+        auto pair = test::reaver::package([]() -> int { throw 1; });
+        pair.packaged_task();
+
+        MAYFLY_REQUIRE_THROWS_TYPE(int, pair.future.get());
+    }
+});
+
+MAYFLY_ADD_TESTCASE("timed wait", []()
+{
+    auto pair = test::reaver::make_promise<int>();
+
+    MAYFLY_REQUIRE(!pair.future.wait_for(std::chrono::milliseconds(1)));
+    MAYFLY_REQUIRE(!pair.future.wait_until(std::chrono::steady_clock::now() + std::chrono::milliseconds(1)));
+
+    // every timed out wait reuses the same waiter, rather than leaving a new one behind
+    for (auto i = 0; i < 1000; ++i)
+    {
+        MAYFLY_REQUIRE(!pair.future.wait_for(std::chrono::microseconds(1)));
+    }
+
+    pair.promise.set(1);
+
+    MAYFLY_REQUIRE(pair.future.wait_for(std::chrono::milliseconds(1)));
+    MAYFLY_REQUIRE(pair.future.try_get() == 1);
+});
+
+MAYFLY_ADD_TESTCASE("concurrent waiters", []()
+{
+    auto pair = test::reaver::make_promise<int>();
+    auto shared = std::move(pair.future).share();
+
+    std::atomic<std::size_t> woken{ 0 };
+    std::vector<std::thread> waiters;
+    for (auto i = 0; i < 4; ++i)
+    {
+        waiters.emplace_back([&, i]() {
+            if (i % 2)
+            {
+                while (!shared.wait_for(std::chrono::microseconds(100)))
+                {
+                }
+            }
+
+            else
+            {
+                shared.get();
+            }
+
+            ++woken;
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    pair.promise.set(1);
+
+    for (auto && waiter : waiters)
+    {
+        waiter.join();
+    }
+
+    MAYFLY_CHECK(woken == 4);
+});
+
+MAYFLY_ADD_TESTCASE("broken promise wakes waiters", []()
+{
+    auto pair = test::reaver::package([]() -> int { return 1; });
+
+    std::thread breaker{ [task = std::move(pair.packaged_task)]() mutable {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        auto dying = std::move(task);
+    } };
+
+    MAYFLY_CHECK_THROWS_TYPE(test::reaver::broken_promise, pair.future.get());
+    breaker.join();
+});
+
+MAYFLY_END_SUITE;
+
+MAYFLY_BEGIN_SUITE("values");
+
+namespace
+{
+    struct copy_counter
+    {
+        copy_counter(std::size_t & copies) : copies{ &copies }
+        {
+        }
+
+        copy_counter(const copy_counter & other) : copies{ other.copies }
+        {
+            ++*copies;
+        }
+
+        copy_counter(copy_counter &&) = default;
+        copy_counter & operator=(const copy_counter &) = default;
+        copy_counter & operator=(copy_counter &&) = default;
+
+        std::size_t * copies;
+    };
+}
+
+MAYFLY_ADD_TESTCASE("take", []()
+{
+    std::size_t copies = 0;
+
+    auto pair = test::reaver::make_promise<copy_counter>();
+    auto copy = pair.future;
+
+    pair.promise.set(copy_counter{ copies });
+
+    // another future still refers to the state, so the value is left there for it
+    auto value = std::move(pair.future).take();
+    MAYFLY_CHECK(copies == 1);
+    MAYFLY_CHECK(value.copies == &copies);
+
+    // that future is the only one left, so it takes the value without copying it
+    MAYFLY_CHECK(copy.is_ready());
+    MAYFLY_CHECK(std::move(copy).take().copies == &copies);
+    MAYFLY_CHECK(copies == 1);
+
+    {
+        auto pair = test::reaver::make_promise<std::unique_ptr<int>>();
+        auto copy = pair.future;
+
+        pair.promise.set(std::make_unique<int>(1));
+        MAYFLY_CHECK(*std::move(pair.future).take() == 1);
+        MAYFLY_CHECK_THROWS_TYPE(test::reaver::future_value_moved, copy.get());
+    }
+
+    // takes racing with gets through other futures to the same state
+    for (std::size_t i = 0; i < 100; ++i)
+    {
+        auto pair = test::reaver::make_promise<std::vector<int>>();
+        auto copy = pair.future;
+        pair.promise.set(std::vector<int>(1000, 1));
+
+        std::size_t read = 0;
+        std::thread reader{ [&read, copy = std::move(copy)]() mutable { read = copy.get().size(); } };
+        auto taken = std::move(pair.future).take();
+        reader.join();
+
+        MAYFLY_CHECK(taken.size() == 1000);
+        MAYFLY_CHECK(read == 1000);
+    }
+});
+
+MAYFLY_ADD_TESTCASE("get on an rvalue", []()
+{
+    std::size_t copies = 0;
+
+    auto pair = test::reaver::make_promise<copy_counter>();
+    pair.promise.set(copy_counter{ copies });
+
+    {
+        auto copy = pair.future;
+        copy.get();
+        MAYFLY_CHECK(copies == 1);
+    }
+
+    std::move(pair.future).get();
+    MAYFLY_CHECK(copies == 1);
+});
+
+MAYFLY_ADD_TESTCASE("shared_future", []()
+{
+    std::size_t copies = 0;
+
+    auto pair = test::reaver::make_promise<copy_counter>();
+    auto copy = pair.future;
+    test::reaver::shared_future<copy_counter> shared = std::move(pair.future).share();
+    auto other = shared;
+
+    MAYFLY_CHECK(!shared.is_ready());
+
+    pair.promise.set(copy_counter{ copies });
+
+    MAYFLY_CHECK(shared.is_ready());
+    MAYFLY_CHECK(&shared.get() == &other.get());
+    MAYFLY_CHECK(copies == 0);
+
+    // futures to the same state copy the value out instead of moving it
+    std::move(copy).take();
+    MAYFLY_CHECK(copies == 1);
+    MAYFLY_CHECK(shared.get().copies == &copies);
+});
+
+MAYFLY_ADD_TESTCASE("shared_future exception", []()
+{
+    auto pair = test::reaver::make_promise<int>();
+    auto shared = std::move(pair.future).share();
+
+    pair.promise.set(std::make_exception_ptr(1));
+
+    MAYFLY_CHECK_THROWS_TYPE(int, shared.get());
+    MAYFLY_CHECK_THROWS_TYPE(int, shared.get());
+});
+
+MAYFLY_END_SUITE;
+
+MAYFLY_BEGIN_SUITE("cancellation");
+
+namespace
+{
+    struct deferred_executor : public test::reaver::executor
+    {
+        virtual void push(test::reaver::function<void ()> f) override
+        {
+            queue.push_back(std::move(f));
+        }
+
+        void run_all()
+        {
+            while (queue.size())
+            {
+                auto fs = move(queue);
+                queue.clear();
+
+                for (auto && f : fs)
+                {
+                    f();
+                }
+            }
+        }
+
+        std::vector<test::reaver::function<void ()>> queue;
+    };
+}
+
+MAYFLY_ADD_TESTCASE("cancelled async", []()
+{
+    auto exec = std::make_shared<deferred_executor>();
+    test::reaver::cancellation_source source;
+
+    bool ran = false;
+    auto future = test::reaver::async(source.token(), exec, [&]{ ran = true; return 1; });
+
+    source.cancel();
+    exec->run_all();
+
+    MAYFLY_CHECK(!ran);
+    MAYFLY_CHECK_THROWS_TYPE(test::reaver::cancelled, future.get());
+});
+
+MAYFLY_ADD_TESTCASE("not cancelled async", []()
+{
+    auto exec = std::make_shared<deferred_executor>();
+    test::reaver::cancellation_source source;
+
+    auto future = test::reaver::async(source.token(), exec, []{ return 2; });
+    exec->run_all();
+
+    MAYFLY_CHECK(source.token().is_cancelled() == false);
+    MAYFLY_CHECK(future.try_get() == 2);
+});
+
+MAYFLY_ADD_TESTCASE("cancelled continuation", []()
+{
+    auto exec = std::make_shared<deferred_executor>();
+    test::reaver::cancellation_source source;
+
+    auto pair = test::reaver::make_promise<int>();
+
+    bool ran = false;
+    auto future = pair.future.then(source.token(), exec, [&](int i){ ran = true; return i; });
+    auto after = future.then(exec, [](int i){ return i + 1; });
+
+    pair.promise.set(1);
+    source.cancel();
+    exec->run_all();
+
+    MAYFLY_CHECK(!ran);
+    MAYFLY_CHECK_THROWS_TYPE(test::reaver::cancelled, future.get());
+    MAYFLY_CHECK_THROWS_TYPE(test::reaver::cancelled, after.get());
+});
+
+MAYFLY_ADD_TESTCASE("abandoned task", []()
+{
+    auto exec = std::make_shared<deferred_executor>();
+
+    bool ran = false;
+    {
+        auto future = test::reaver::async(exec, [&]{ ran = true; });
+    }
+
+    exec->run_all();
+    MAYFLY_CHECK(!ran);
+});
+
+MAYFLY_END_SUITE;
+
 MAYFLY_END_SUITE;
 
@@ -0,0 +1,85 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+#include <reaver/mayfly.h>
+
+#include <memory>
+#include <vector>
+
+namespace test
+{
+#   include "inline_executor.h"
+}
+
+namespace
+{
+    struct queue_executor : test::reaver::executor
+    {
+        virtual void push(test::reaver::function<void ()> f) override
+        {
+            queue.push_back(std::move(f));
+        }
+
+        std::vector<test::reaver::function<void ()>> queue;
+    };
+}
+
+MAYFLY_BEGIN_SUITE("inline executor");
+
+MAYFLY_ADD_TESTCASE("running tasks", []()
+{
+    auto fallback = std::make_shared<queue_executor>();
+    test::reaver::inline_executor exec{ fallback };
+
+    bool invoked = false;
+    exec.push([&]{ invoked = true; });
+
+    MAYFLY_CHECK(invoked);
+    MAYFLY_CHECK(fallback->queue.empty());
+});
+
+MAYFLY_ADD_TESTCASE("falling back when nested too deeply", []()
+{
+    auto fallback = std::make_shared<queue_executor>();
+    test::reaver::inline_executor exec{ fallback, 2 };
+
+    std::size_t invoked = 0;
+    exec.push([&]{
+        ++invoked;
+        exec.push([&]{
+            ++invoked;
+            exec.push([&]{ ++invoked; });
+        });
+    });
+
+    MAYFLY_CHECK(invoked == 2);
+    MAYFLY_REQUIRE(fallback->queue.size() == 1);
+
+    fallback->queue.front()();
+    MAYFLY_CHECK(invoked == 3);
+
+    // the depth is restored once the nested tasks return
+    exec.push([&]{ ++invoked; });
+    MAYFLY_CHECK(invoked == 4);
+    MAYFLY_CHECK(fallback->queue.size() == 1);
+});
+
+MAYFLY_END_SUITE;
@@ -0,0 +1,120 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+
+#include <reaver/mayfly.h>
+
+#include <queue>
+#include <future>
+#include <array>
+#include <memory>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <limits>
+#include <algorithm>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace test
+{
+#   include "numa_thread_pool.h"
+}
+
+MAYFLY_BEGIN_SUITE("numa thread pool");
+
+MAYFLY_ADD_TESTCASE("parsing cpu lists", []
+{
+    MAYFLY_CHECK(test::reaver::parse_cpu_list("0") == std::vector<std::size_t>{ 0 });
+    MAYFLY_CHECK(test::reaver::parse_cpu_list("0-3,8,10-11\n") == (std::vector<std::size_t>{ 0, 1, 2, 3, 8, 10, 11 }));
+    MAYFLY_CHECK(test::reaver::parse_cpu_list("").empty());
+    MAYFLY_CHECK(test::reaver::parse_cpu_list("3-1,x,5") == std::vector<std::size_t>{ 5 });
+});
+
+MAYFLY_ADD_TESTCASE("pinning workers", []
+{
+    test::reaver::thread_pool pool{ 1, test::reaver::thread_pool_args::cpus{ std::size_t{ 0 } } };
+    auto cpu = pool.push([]{ return test::reaver::current_cpu(); });
+
+#ifdef __linux__
+    MAYFLY_CHECK(cpu.get() == 0);
+#else
+    cpu.get();
+#endif
+});
+
+MAYFLY_ADD_TESTCASE("pushing to nodes", []
+{
+    // nodes without cpus don't pin their workers, so this works regardless of the topology of the machine
+    test::reaver::numa_thread_pool pool{ std::vector<test::reaver::numa_node>{ { 0, {} }, { 1, {} } }, test::reaver::thread_pool_args::threads_per_node{ std::size_t{ 1 } } };
+
+    MAYFLY_REQUIRE(pool.node_count() == 2);
+    MAYFLY_CHECK(pool.node_id(1) == 1);
+    MAYFLY_CHECK(pool.node(0)->size() == 1);
+
+    std::array<std::promise<void>, 3> done;
+    pool.push_to(0, [&]{ done[0].set_value(); });
+    pool.push_to(1, [&]{ done[1].set_value(); });
+    pool.push([&]{ done[2].set_value(); });
+
+    for (auto && promise : done)
+    {
+        promise.get_future().get();
+    }
+
+    MAYFLY_REQUIRE_THROWS_TYPE(std::out_of_range, pool.push_to(2, []{}));
+});
+
+MAYFLY_ADD_TESTCASE("passing options to the node pools", []
+{
+    test::reaver::numa_thread_pool pool{ std::vector<test::reaver::numa_node>{ { 0, {} } },
+        test::reaver::thread_pool_args::threads_per_node{ std::size_t{ 1 } },
+        test::reaver::thread_pool_args::capacity{ std::size_t{ 1 } },
+        test::reaver::thread_pool_args::overflow{ test::reaver::overflow_policy::reject },
+        test::reaver::thread_pool_args::statistics{ true } };
+
+    auto node = pool.node(0);
+
+    std::promise<void> go;
+    auto blocker = go.get_future().share();
+    std::promise<void> started;
+
+    auto blocked = node->push([&, blocker]{ started.set_value(); blocker.wait(); });
+    started.get_future().get();
+
+    auto queued = node->push([]{});
+    MAYFLY_CHECK_THROWS_TYPE(test::reaver::thread_pool_full, pool.push_to(0, []{}));
+
+    go.set_value();
+    blocked.get();
+    queued.get();
+
+    while (node->statistics().total.executed != 2)
+    {
+        std::this_thread::yield();
+    }
+});
+
+MAYFLY_END_SUITE;
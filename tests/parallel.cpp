@@ -0,0 +1,122 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+#include <reaver/mayfly.h>
+
+#include <atomic>
+#include <numeric>
+#include <string>
+#include <vector>
+
+namespace test
+{
+#   include "parallel.h"
+#   include "thread_pool.h"
+}
+
+namespace
+{
+    struct counting_executor : test::reaver::executor
+    {
+        virtual void push(test::reaver::function<void ()> f) override
+        {
+            ++pushed;
+            f();
+        }
+
+        std::size_t pushed = 0;
+    };
+}
+
+MAYFLY_BEGIN_SUITE("parallel algorithms");
+
+MAYFLY_ADD_TESTCASE("parallel_for", []
+{
+    auto pool = test::reaver::make_executor<test::reaver::thread_pool>(4);
+
+    std::vector<int> values(10000, 1);
+    test::reaver::parallel_for(pool, values, [](int & value){ value *= 2; }).get();
+    MAYFLY_CHECK(std::accumulate(values.begin(), values.end(), 0) == 20000);
+
+    std::vector<std::atomic<int>> hits(1000);
+    test::reaver::parallel_for(pool, std::size_t{ 0 }, hits.size(), [&](std::size_t i){ ++hits[i]; }, 7).get();
+    MAYFLY_CHECK(std::all_of(hits.begin(), hits.end(), [](auto & hit){ return hit == 1; }));
+
+    auto exec = std::make_shared<counting_executor>();
+    test::reaver::parallel_for(exec, 0, 100, [](int){}, 10).get();
+    MAYFLY_CHECK(exec->pushed == 10);
+
+    test::reaver::parallel_for(exec, 0, 0, [](int){ throw 1; }).get();
+    MAYFLY_CHECK(exec->pushed == 10);
+});
+
+MAYFLY_ADD_TESTCASE("exceptions", []
+{
+    auto exec = std::make_shared<counting_executor>();
+
+    std::size_t invoked = 0;
+    auto future = test::reaver::parallel_for(exec, 0, 100, [&](int i) {
+        ++invoked;
+        if (i == 15)
+        {
+            throw 42;
+        }
+    }, 10);
+
+    // the chunks after the failing one are skipped
+    MAYFLY_CHECK(invoked == 16);
+    MAYFLY_CHECK(exec->pushed == 10);
+    MAYFLY_CHECK_THROWS_TYPE(int, future.get());
+});
+
+MAYFLY_ADD_TESTCASE("parallel_transform", []
+{
+    auto pool = test::reaver::make_executor<test::reaver::thread_pool>(4);
+
+    std::vector<int> values(1000);
+    std::iota(values.begin(), values.end(), 0);
+
+    auto squares = test::reaver::parallel_transform(pool, values, [](int i){ return static_cast<long>(i) * i; }).get();
+    MAYFLY_REQUIRE(squares.size() == 1000);
+    MAYFLY_CHECK(squares[999] == 999l * 999);
+
+    std::vector<int> out(1000);
+    test::reaver::parallel_transform(pool, values.begin(), values.end(), out.begin(), [](int i){ return -i; }, 33).get();
+    MAYFLY_CHECK(out[0] == 0);
+    MAYFLY_CHECK(out[999] == -999);
+});
+
+MAYFLY_ADD_TESTCASE("parallel_reduce", []
+{
+    auto pool = test::reaver::make_executor<test::reaver::thread_pool>(4);
+
+    std::vector<long> values(100000);
+    std::iota(values.begin(), values.end(), 1);
+
+    MAYFLY_CHECK(test::reaver::parallel_reduce(pool, values, 0l, std::plus<>()).get() == 5000050000l);
+    MAYFLY_CHECK(test::reaver::parallel_reduce(pool, 0, 0, 5, std::plus<>()).get() == 5);
+
+    // not commutative; the partial results have to be combined in order
+    std::vector<std::string> words{ "a", "b", "c", "d", "e", "f", "g" };
+    MAYFLY_CHECK(test::reaver::parallel_reduce(pool, words, std::string{ ">" }, std::plus<>(), 2).get() == ">abcdefg");
+});
+
+MAYFLY_END_SUITE;
@@ -0,0 +1,185 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+
+#include <reaver/mayfly.h>
+
+#include <queue>
+#include <future>
+#include <vector>
+#include <thread>
+#include <stdexcept>
+
+#include <boost/functional/hash.hpp>
+
+namespace test
+{
+#   include "future.h"
+#   include "strand.h"
+}
+
+namespace
+{
+    struct queue_executor : test::reaver::executor
+    {
+        virtual void push(test::reaver::function<void ()> f) override
+        {
+            if (refuse)
+            {
+                throw std::runtime_error{ "refused" };
+            }
+
+            queue.push_back(std::move(f));
+        }
+
+        std::vector<test::reaver::function<void ()>> queue;
+        bool refuse = false;
+    };
+}
+
+MAYFLY_BEGIN_SUITE("strand");
+
+MAYFLY_ADD_TESTCASE("scheduling a single drain task", []()
+{
+    auto underlying = std::make_shared<queue_executor>();
+    test::reaver::strand strand{ underlying, 2 };
+
+    std::vector<int> order;
+    strand.push([&]{ order.push_back(1); });
+    strand.push([&]{ order.push_back(2); });
+    strand.push([&]{ order.push_back(3); });
+
+    MAYFLY_REQUIRE(underlying->queue.size() == 1);
+
+    // the drain task gives the thread back after max_batch tasks, and reschedules itself
+    auto drain = std::move(underlying->queue.front());
+    underlying->queue.clear();
+    drain();
+
+    MAYFLY_CHECK(order == (std::vector<int>{ 1, 2 }));
+    MAYFLY_REQUIRE(underlying->queue.size() == 1);
+
+    drain = std::move(underlying->queue.front());
+    underlying->queue.clear();
+    drain();
+
+    MAYFLY_CHECK(order == (std::vector<int>{ 1, 2, 3 }));
+    MAYFLY_CHECK(underlying->queue.empty());
+
+    strand.push([&]{ order.push_back(4); });
+    MAYFLY_CHECK(underlying->queue.size() == 1);
+});
+
+MAYFLY_ADD_TESTCASE("underlying executor refusing tasks", []()
+{
+    auto underlying = std::make_shared<queue_executor>();
+    test::reaver::strand strand{ underlying, 1 };
+
+    std::vector<int> order;
+
+    underlying->refuse = true;
+    MAYFLY_REQUIRE_THROWS_TYPE(std::runtime_error, strand.push([&]{ order.push_back(1); }));
+    MAYFLY_CHECK(order.empty());
+
+    // the refused push doesn't leave the strand waiting for a drain task
+    underlying->refuse = false;
+    strand.push([&]{ order.push_back(2); });
+    strand.push([&]{ order.push_back(3); });
+    MAYFLY_REQUIRE(underlying->queue.size() == 1);
+
+    // a drain task that can't give the thread back keeps draining on it
+    auto drain = std::move(underlying->queue.front());
+    underlying->queue.clear();
+    underlying->refuse = true;
+    drain();
+
+    MAYFLY_CHECK(order == (std::vector<int>{ 2, 3 }));
+    MAYFLY_CHECK(underlying->queue.empty());
+
+    underlying->refuse = false;
+    strand.push([&]{ order.push_back(4); });
+    MAYFLY_REQUIRE(underlying->queue.size() == 1);
+});
+
+MAYFLY_ADD_TESTCASE("serial execution on a thread pool", []()
+{
+    auto pool = std::make_shared<test::reaver::thread_pool>(4);
+    auto strand = std::make_shared<test::reaver::strand>(pool);
+
+    constexpr std::size_t producers = 4;
+    constexpr std::size_t per_producer = 1000;
+
+    std::atomic<bool> running{ false };
+    std::atomic<bool> overlapped{ false };
+    std::vector<std::size_t> last(producers, 0);
+    bool out_of_order = false;
+    std::atomic<std::size_t> done{ 0 };
+    std::promise<void> finished;
+
+    std::vector<std::thread> threads;
+    for (std::size_t p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&, p]{
+            for (std::size_t i = 1; i <= per_producer; ++i)
+            {
+                strand->push([&, p, i]{
+                    if (running.exchange(true))
+                    {
+                        overlapped = true;
+                    }
+
+                    // not synchronized, on purpose: the strand must make this safe
+                    if (last[p] + 1 != i)
+                    {
+                        out_of_order = true;
+                    }
+                    last[p] = i;
+
+                    running = false;
+
+                    if (++done == producers * per_producer)
+                    {
+                        finished.set_value();
+                    }
+                });
+            }
+        });
+    }
+
+    for (auto && thread : threads)
+    {
+        thread.join();
+    }
+
+    finished.get_future().get();
+    MAYFLY_CHECK(!overlapped);
+    MAYFLY_CHECK(!out_of_order);
+});
+
+MAYFLY_ADD_TESTCASE("continuations on a strand", []()
+{
+    auto strand = std::make_shared<test::reaver::strand>();
+
+    auto future = test::reaver::make_ready_future(1).then(strand, [](int i){ return i + 1; });
+    MAYFLY_CHECK(future.get() == 2);
+});
+
+MAYFLY_END_SUITE;
@@ -30,6 +30,13 @@
 //#include <atomic>
 //#include <mutex>
 #include <future>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <cstdint>
+#include <iterator>
 //#include <type_traits>
 
 #include <boost/functional/hash.hpp>
@@ -37,6 +44,7 @@
 namespace test
 {
 #   include "thread_pool.h"
+#   include "future.h"
 }
 
 MAYFLY_BEGIN_SUITE("thread pool");
@@ -66,6 +74,295 @@ MAYFLY_ADD_TESTCASE("running tasks", []
     }
 });
 
+MAYFLY_ADD_TESTCASE("bulk push", []
+{
+    test::reaver::thread_pool pool{ 4 };
+
+    std::atomic<std::size_t> count{ 0 };
+    std::promise<void> done;
+
+    std::vector<test::reaver::function<void ()>> tasks;
+    for (std::size_t i = 0; i < 1000; ++i)
+    {
+        tasks.emplace_back([&]{
+            if (++count == 1000)
+            {
+                done.set_value();
+            }
+        });
+    }
+
+    pool.push_bulk(std::move(tasks));
+    pool.push_bulk({});
+
+    done.get_future().get();
+    MAYFLY_REQUIRE(count == 1000);
+});
+
+MAYFLY_ADD_TESTCASE("spinning idle policy", []
+{
+    test::reaver::thread_pool pool{ 2, { 1000, 10 } };
+
+    for (std::size_t i = 0; i < 100; ++i)
+    {
+        auto future = pool.push([=]{ return i; });
+        MAYFLY_REQUIRE(future.get() == i);
+    }
+
+    std::promise<void> done;
+    pool.push(test::reaver::function<void ()>{ [&]{ done.set_value(); } });
+    done.get_future().get();
+});
+
+MAYFLY_ADD_TESTCASE("priority lanes", []
+{
+    auto pool = std::make_shared<test::reaver::thread_pool>(1);
+
+    // keep the only worker busy until everything is queued
+    std::promise<void> go;
+    auto blocker = go.get_future().share();
+    pool->push(test::reaver::function<void ()>{ [blocker]{ blocker.wait(); } });
+
+    std::vector<test::reaver::priority> order;
+    std::mutex order_lock;
+    auto record = [&](test::reaver::priority lane) {
+        return test::reaver::function<void ()>{ [&, lane]{
+            std::lock_guard<std::mutex> lock{ order_lock };
+            order.push_back(lane);
+        } };
+    };
+
+    test::reaver::prioritized_executor background{ pool, test::reaver::priority::background };
+    background.push(record(test::reaver::priority::background));
+    pool->push(record(test::reaver::priority::normal));
+    pool->push(test::reaver::priority::high, record(test::reaver::priority::high));
+
+    auto last = pool->push(test::reaver::priority::background, []{});
+
+    go.set_value();
+    last.get();
+
+    MAYFLY_REQUIRE(order.size() == 3);
+    MAYFLY_CHECK(order[0] == test::reaver::priority::high);
+    MAYFLY_CHECK(order[1] == test::reaver::priority::normal);
+    MAYFLY_CHECK(order[2] == test::reaver::priority::background);
+});
+
+MAYFLY_ADD_TESTCASE("starvation protection", []
+{
+    test::reaver::thread_pool pool{ 1 };
+
+    std::promise<void> go;
+    auto blocker = go.get_future().share();
+    pool.push(test::reaver::function<void ()>{ [blocker]{ blocker.wait(); } });
+
+    std::atomic<std::size_t> high_done{ 0 };
+    std::size_t high_before_background = 0;
+
+    auto background = pool.push(test::reaver::priority::background, [&]{ high_before_background = high_done; });
+
+    std::vector<test::reaver::function<void ()>> high;
+    for (std::size_t i = 0; i < 10 * test::reaver::thread_pool::starvation_limit; ++i)
+    {
+        high.emplace_back([&]{ ++high_done; });
+    }
+    pool.push_bulk(test::reaver::priority::high, std::move(high));
+
+    go.set_value();
+    background.get();
+
+    MAYFLY_CHECK(high_before_background == test::reaver::thread_pool::starvation_limit);
+});
+
+MAYFLY_ADD_TESTCASE("bounded queue", []
+{
+    namespace args = test::reaver::thread_pool_args;
+
+    auto blocked_pool = [](auto & pool) {
+        auto go = std::make_shared<std::promise<void>>();
+        auto blocker = go->get_future().share();
+        std::promise<void> started;
+        auto started_future = started.get_future();
+        pool.push(test::reaver::function<void ()>{ [blocker, started = std::move(started)]() mutable { started.set_value(); blocker.wait(); } });
+        started_future.get();
+        return go;
+    };
+
+    {
+        test::reaver::thread_pool pool{ 1, args::capacity{ std::size_t{ 2 } }, args::overflow{ test::reaver::overflow_policy::reject } };
+        auto go = blocked_pool(pool);
+
+        pool.push(test::reaver::function<void ()>{ []{} });
+        MAYFLY_CHECK(pool.try_push([]{}));
+        MAYFLY_CHECK(pool.queue_depth() == 2);
+
+        MAYFLY_CHECK(!pool.try_push([]{}));
+        MAYFLY_REQUIRE_THROWS_TYPE(test::reaver::thread_pool_full, pool.push(test::reaver::function<void ()>{ []{} }));
+
+        go->set_value();
+    }
+
+    {
+        test::reaver::thread_pool pool{ 1, args::capacity{ std::size_t{ 1 } }, args::overflow{ test::reaver::overflow_policy::run_inline } };
+        auto go = blocked_pool(pool);
+
+        pool.push(test::reaver::function<void ()>{ []{} });
+
+        auto caller = std::this_thread::get_id();
+        std::thread::id ran_on;
+        pool.push(test::reaver::function<void ()>{ [&]{ ran_on = std::this_thread::get_id(); } });
+        MAYFLY_CHECK(ran_on == caller);
+
+        go->set_value();
+    }
+
+    {
+        test::reaver::thread_pool pool{ 1, args::capacity{ std::size_t{ 1 } } };
+        auto go = blocked_pool(pool);
+
+        pool.push(test::reaver::function<void ()>{ []{} });
+
+        std::atomic<bool> pushed{ false };
+        std::thread producer{ [&]{
+            pool.push(test::reaver::function<void ()>{ []{} });
+            pushed = true;
+        } };
+
+        std::this_thread::sleep_for(std::chrono::milliseconds{ 10 });
+        MAYFLY_CHECK(!pushed);
+
+        go->set_value();
+        producer.join();
+        MAYFLY_CHECK(pushed);
+    }
+
+    // workers pushing into their own full queue go past the capacity, instead of waiting for themselves or throwing
+    for (auto policy : { test::reaver::overflow_policy::block, test::reaver::overflow_policy::reject })
+    {
+        test::reaver::thread_pool pool{ 1, args::capacity{ std::size_t{ 1 } }, args::overflow{ policy } };
+
+        auto go = std::make_shared<std::promise<void>>();
+        auto blocker = go->get_future().share();
+        std::promise<void> started;
+        std::promise<bool> continued;
+
+        pool.push(test::reaver::function<void ()>{ [&, blocker]{
+            started.set_value();
+            blocker.wait();
+
+            pool.push(test::reaver::function<void ()>{ [&]{ continued.set_value(true); } });
+        } });
+        started.get_future().get();
+
+        pool.push(test::reaver::function<void ()>{ []{} });
+        MAYFLY_CHECK(pool.queue_depth() == 1);
+
+        go->set_value();
+        MAYFLY_CHECK(continued.get_future().get());
+    }
+});
+
+MAYFLY_ADD_TESTCASE("statistics", []
+{
+    {
+        test::reaver::thread_pool pool{ 2, test::reaver::thread_pool_args::statistics{ true } };
+
+        std::vector<std::future<void>> futures;
+        for (std::size_t i = 0; i < 100; ++i)
+        {
+            futures.push_back(pool.push([]{}));
+        }
+
+        for (auto && future : futures)
+        {
+            future.get();
+        }
+
+        // the counters are updated right after a task returns, which can be after its future becomes ready
+        while (pool.statistics().total.executed != 100)
+        {
+            std::this_thread::yield();
+        }
+
+        auto stats = pool.statistics();
+        MAYFLY_CHECK(stats.workers == 2);
+        MAYFLY_CHECK(stats.queue_depth == 0);
+        MAYFLY_CHECK(stats.per_worker.size() == 2);
+        MAYFLY_CHECK(stats.total.latency.count() == 100);
+        MAYFLY_CHECK(stats.total.latency.quantile(0.5) <= stats.total.latency.quantile(0.99));
+    }
+
+    {
+        test::reaver::thread_pool pool{ 2 };
+        pool.push([]{}).get();
+
+        auto stats = pool.statistics();
+        MAYFLY_CHECK(stats.workers == 2);
+        MAYFLY_CHECK(stats.total.executed == 0);
+        MAYFLY_CHECK(stats.per_worker.empty());
+    }
+});
+
+MAYFLY_ADD_TESTCASE("latency histogram", []
+{
+    using test::reaver::latency_histogram;
+
+    MAYFLY_CHECK(latency_histogram::bucket(std::chrono::nanoseconds{ 0 }) == 0);
+    MAYFLY_CHECK(latency_histogram::bucket(std::chrono::nanoseconds{ 1 }) == 0);
+    MAYFLY_CHECK(latency_histogram::bucket(std::chrono::nanoseconds{ 1024 }) == 10);
+    MAYFLY_CHECK(latency_histogram::bucket(std::chrono::hours{ 1 }) == latency_histogram::bucket_count - 1);
+
+    latency_histogram histogram;
+    histogram.buckets[3] = 99;
+    histogram.buckets[10] = 1;
+    MAYFLY_CHECK(histogram.count() == 100);
+    MAYFLY_CHECK(histogram.quantile(0.5) == std::chrono::nanoseconds{ 16 });
+    MAYFLY_CHECK(histogram.quantile(0.995) == std::chrono::nanoseconds{ 2048 });
+});
+
+MAYFLY_ADD_TESTCASE("shutdown", []
+{
+    {
+        test::reaver::thread_pool pool{ 2 };
+
+        std::promise<void> go;
+        auto blocker = go.get_future().share();
+        pool.push(test::reaver::function<void ()>{ [blocker]{ blocker.wait(); } });
+
+        std::atomic<std::size_t> executed{ 0 };
+        for (std::size_t i = 0; i < 10; ++i)
+        {
+            pool.push(test::reaver::function<void ()>{ [&]{ ++executed; } });
+        }
+
+        auto done = pool.shutdown();
+        MAYFLY_CHECK(!done.wait_for(std::chrono::milliseconds{ 10 }));
+        MAYFLY_REQUIRE_THROWS_TYPE(test::reaver::thread_pool_closed, pool.push([]{}));
+        MAYFLY_REQUIRE_THROWS_TYPE(test::reaver::thread_pool_closed, pool.push(test::reaver::function<void ()>{ []{} }));
+
+        go.set_value();
+        done.get();
+        MAYFLY_CHECK(executed == 10);
+        MAYFLY_CHECK(pool.size() == 0);
+    }
+
+    {
+        test::reaver::thread_pool pool{ 1 };
+
+        std::promise<void> go;
+        auto blocker = go.get_future().share();
+        pool.push(test::reaver::function<void ()>{ [blocker]{ blocker.wait(); } });
+        auto dropped = pool.push([]{ return 1; });
+
+        auto done = pool.shutdown(std::chrono::milliseconds{ 1 });
+        std::this_thread::sleep_for(std::chrono::milliseconds{ 5 });
+
+        go.set_value();
+        done.get();
+        MAYFLY_REQUIRE_THROWS_TYPE(std::future_error, dropped.get());
+    }
+});
+
 MAYFLY_ADD_TESTCASE("handling aborted pools", []
 {
     test::reaver::thread_pool pool{ 1 };
@@ -88,6 +385,209 @@ MAYFLY_ADD_TESTCASE("resizing", []
             std::this_thread::yield();
         }
     }
+
+    {
+        test::reaver::thread_pool pool{ 4 };
+        pool.resize(1).get();
+        MAYFLY_CHECK(pool.size() == 1);
+        pool.resize(3).get();
+        MAYFLY_CHECK(pool.size() == 3);
+
+        auto future = pool.push([]{ return 1; });
+        MAYFLY_CHECK(future.get() == 1);
+    }
+
+    {
+        // shrinking waits for workers that are busy with a task
+        test::reaver::thread_pool pool{ 2 };
+
+        std::promise<void> go;
+        auto blocker = go.get_future().share();
+        pool.push(test::reaver::function<void ()>{ [blocker]{ blocker.wait(); } });
+        pool.push(test::reaver::function<void ()>{ [blocker]{ blocker.wait(); } });
+
+        auto shrunk = pool.resize(0);
+        MAYFLY_CHECK(!shrunk.wait_for(std::chrono::milliseconds{ 10 }));
+
+        go.set_value();
+        shrunk.get();
+        MAYFLY_CHECK(pool.size() == 0);
+    }
+
+    {
+        // tasks still queued when the pool is shrunk run before the last worker exits
+        test::reaver::thread_pool pool{ 1 };
+
+        std::promise<void> go;
+        auto blocker = go.get_future().share();
+        pool.push(test::reaver::function<void ()>{ [blocker]{ blocker.wait(); } });
+        auto queued = pool.push([]{ return 1; });
+
+        auto shrunk = pool.resize(0);
+        go.set_value();
+
+        MAYFLY_CHECK(queued.get() == 1);
+        shrunk.get();
+        MAYFLY_CHECK(pool.size() == 0);
+    }
+
+    {
+        // shrinking doesn't wait for the queue to empty while other workers remain
+        test::reaver::thread_pool pool{ 4 };
+
+        std::atomic<bool> stop{ false };
+        std::thread producer{ [&]{
+            while (!stop)
+            {
+                if (pool.queue_depth() < 64)
+                {
+                    pool.push(test::reaver::function<void ()>{ []{ std::this_thread::sleep_for(std::chrono::microseconds{ 100 }); } });
+                }
+
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        } };
+
+        while (pool.queue_depth() == 0)
+        {
+            std::this_thread::yield();
+        }
+
+        auto shrunk = pool.resize(1);
+        MAYFLY_CHECK(shrunk.wait_for(std::chrono::seconds{ 5 }));
+        MAYFLY_CHECK(pool.size() == 1);
+
+        stop = true;
+        producer.join();
+    }
+
+    {
+        // the returned futures are completed outside of the pool's lock, so that continuations can push into the pool
+        test::reaver::thread_pool pool{ 2 };
+
+        auto pushed = pool.resize(1).then(test::reaver::inline_, [&]{ return pool.push([]{ return 1; }).get(); });
+        MAYFLY_CHECK(pushed.get() == 1);
+
+        auto drained = pool.shutdown().then(test::reaver::inline_, [&]{ return pool.size(); });
+        MAYFLY_CHECK(drained.get() == 0);
+    }
+});
+
+MAYFLY_ADD_TESTCASE("elastic sizing", []
+{
+    test::reaver::elastic_policy policy;
+    policy.min = 1;
+    policy.max = 4;
+    policy.grow_after = std::chrono::microseconds{ 100 };
+    policy.shrink_after = std::chrono::milliseconds{ 10 };
+
+    test::reaver::thread_pool pool{ 1, test::reaver::thread_pool_args::elastic{ policy } };
+    MAYFLY_REQUIRE(pool.size() == 1);
+
+    // four tasks that can only finish together need the pool to grow to four workers
+    std::atomic<std::size_t> running{ 0 };
+    std::vector<std::future<void>> futures;
+    for (std::size_t i = 0; i < 4; ++i)
+    {
+        futures.push_back(pool.push([&]{
+            ++running;
+            while (running != 4)
+            {
+                std::this_thread::yield();
+            }
+        }));
+
+        std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+    }
+
+    // pushes trigger growth; keep pushing no-ops until the blocked tasks have all been picked up
+    while (running != 4)
+    {
+        pool.push([]{});
+        std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+    }
+
+    for (auto && future : futures)
+    {
+        future.get();
+    }
+    MAYFLY_CHECK(pool.size() <= 4);
+
+    while (pool.size() != 1)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+    }
+});
+
+MAYFLY_ADD_TESTCASE("same worker continuations", []
+{
+    test::reaver::thread_pool pool{ 4, test::reaver::thread_pool_args::same_worker{ true } };
+
+    for (std::size_t i = 0; i < 16; ++i)
+    {
+        std::promise<bool> same;
+        auto future = same.get_future();
+
+        pool.push(test::reaver::function<void ()>{ [&]{
+            auto id = std::this_thread::get_id();
+            pool.push(test::reaver::function<void ()>{ [&, id]{ same.set_value(id == std::this_thread::get_id()); } });
+        } });
+
+        MAYFLY_CHECK(future.get());
+    }
+
+    // only the newest task stays with the worker; the older one can be taken by anyone, and both run
+    std::atomic<std::size_t> done{ 0 };
+    std::promise<void> finished;
+
+    pool.push(test::reaver::function<void ()>{ [&]{
+        for (std::size_t i = 0; i < 2; ++i)
+        {
+            pool.push(test::reaver::function<void ()>{ [&]{
+                if (++done == 2)
+                {
+                    finished.set_value();
+                }
+            } });
+        }
+    } });
+
+    finished.get_future().get();
+});
+
+MAYFLY_ADD_TESTCASE("same worker starvation protection", []
+{
+    test::reaver::thread_pool pool{ 1, test::reaver::thread_pool_args::same_worker{ true } };
+
+    std::atomic<bool> stop{ false };
+    std::atomic<std::size_t> chained{ 0 };
+    std::promise<void> chain_done;
+
+    std::function<void ()> chain = [&]{
+        if (stop || ++chained == 100000)
+        {
+            chain_done.set_value();
+            return;
+        }
+
+        pool.push(test::reaver::function<void ()>{ [&]{ chain(); } });
+    };
+
+    std::promise<void> started;
+    pool.push(test::reaver::function<void ()>{ [&]{
+        started.set_value();
+        chain();
+    } });
+    started.get_future().get();
+
+    // a task from outside the pool gets its turn while the chain keeps the worker busy
+    pool.push([&]{ stop = true; }).get();
+    chain_done.get_future().get();
+
+    MAYFLY_CHECK(chained < 100000);
 });
 
 MAYFLY_END_SUITE;
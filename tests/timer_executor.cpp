@@ -0,0 +1,161 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+
+#include <reaver/mayfly.h>
+
+#include <queue>
+#include <future>
+#include <vector>
+#include <thread>
+#include <condition_variable>
+
+#include <boost/functional/hash.hpp>
+
+namespace test
+{
+#   include "future.h"
+#   include "timer_executor.h"
+}
+
+MAYFLY_BEGIN_SUITE("timer executor");
+
+MAYFLY_ADD_TESTCASE("delayed tasks", []()
+{
+    auto pool = std::make_shared<test::reaver::thread_pool>(1);
+    test::reaver::timer_executor timers{ pool };
+
+    std::mutex lock;
+    std::vector<int> order;
+    std::promise<void> done;
+
+    auto start = std::chrono::steady_clock::now();
+
+    timers.schedule_after(std::chrono::milliseconds{ 30 }, [&]{
+        std::lock_guard<std::mutex> guard{ lock };
+        order.push_back(2);
+        done.set_value();
+    });
+    timers.schedule_after(std::chrono::milliseconds{ 10 }, [&]{
+        std::lock_guard<std::mutex> guard{ lock };
+        order.push_back(1);
+    });
+
+    done.get_future().get();
+
+    MAYFLY_CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds{ 30 });
+    MAYFLY_CHECK(order == (std::vector<int>{ 1, 2 }));
+});
+
+MAYFLY_ADD_TESTCASE("cancelling", []()
+{
+    test::reaver::timer_executor timers;
+
+    std::atomic<bool> fired{ false };
+    auto handle = timers.schedule_after(std::chrono::milliseconds{ 20 }, [&]{ fired = true; });
+    auto far = timers.schedule_after(std::chrono::hours{ 24 * 365 * 5 }, []{});
+    MAYFLY_CHECK(timers.pending() == 2);
+
+    MAYFLY_CHECK(handle.cancel());
+    MAYFLY_CHECK(!handle.cancel());
+    MAYFLY_CHECK(far.cancel());
+    MAYFLY_CHECK(timers.pending() == 0);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds{ 40 });
+    MAYFLY_CHECK(!fired);
+
+    std::vector<test::reaver::timer_handle> handles;
+    for (std::size_t i = 0; i < 100000; ++i)
+    {
+        handles.push_back(timers.schedule_after(std::chrono::seconds{ 1 + i % 1000 }, []{}));
+    }
+    MAYFLY_CHECK(timers.pending() == 100000);
+
+    for (auto && handle : handles)
+    {
+        handle.cancel();
+    }
+    MAYFLY_CHECK(timers.pending() == 0);
+});
+
+MAYFLY_ADD_TESTCASE("periodic tasks", []()
+{
+    test::reaver::timer_executor timers;
+
+    std::atomic<std::size_t> runs{ 0 };
+    auto handle = timers.schedule_every(std::chrono::milliseconds{ 2 }, [&]{ ++runs; });
+
+    while (runs < 5)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+    }
+
+    handle.cancel();
+    std::this_thread::sleep_for(std::chrono::milliseconds{ 20 });
+
+    auto after_cancel = runs.load();
+    std::this_thread::sleep_for(std::chrono::milliseconds{ 20 });
+    MAYFLY_CHECK(runs == after_cancel);
+    MAYFLY_CHECK(timers.pending() == 0);
+});
+
+MAYFLY_ADD_TESTCASE("timeout futures", []()
+{
+    test::reaver::timer_executor timers;
+
+    auto start = std::chrono::steady_clock::now();
+    auto future = timers.make_timeout_future(std::chrono::milliseconds{ 10 });
+    MAYFLY_CHECK_NOTHROW(future.get());
+    MAYFLY_CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds{ 10 });
+});
+
+MAYFLY_ADD_TESTCASE("future timeouts", []()
+{
+    auto timers = std::make_shared<test::reaver::timer_executor>();
+
+    {
+        auto pair = test::reaver::make_promise<int>();
+        auto limited = test::reaver::timeout(timers, std::move(pair.future), std::chrono::milliseconds{ 5 });
+        MAYFLY_REQUIRE_THROWS_TYPE(test::reaver::future_timeout, limited.get());
+
+        // too late; nothing observes it anymore
+        pair.promise.set(1);
+    }
+
+    {
+        auto pair = test::reaver::make_promise<int>();
+        auto limited = test::reaver::timeout(timers, std::move(pair.future), std::chrono::hours{ 1 });
+        MAYFLY_CHECK(timers->pending() == 1);
+
+        pair.promise.set(1);
+        MAYFLY_CHECK(limited.get() == 1);
+        // the timer entry is released as soon as the value wins
+        MAYFLY_CHECK(timers->pending() == 0);
+    }
+
+    {
+        auto limited = test::reaver::timeout(timers, test::reaver::make_ready_future(), std::chrono::hours{ 1 });
+        MAYFLY_CHECK_NOTHROW(limited.get());
+        MAYFLY_CHECK(timers->pending() == 0);
+    }
+});
+
+MAYFLY_END_SUITE;
@@ -0,0 +1,148 @@
+/**
+ * Reaver Library Licence
+ *
+ * Copyright © 2016 Michał "Griwes" Dominiak
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation is required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ **/
+
+#include <reaver/mayfly.h>
+
+#include <queue>
+#include <future>
+
+#include <boost/functional/hash.hpp>
+
+namespace test
+{
+#   include "future.h"
+#   include "work_stealing_pool.h"
+}
+
+MAYFLY_BEGIN_SUITE("work stealing pool");
+
+MAYFLY_ADD_TESTCASE("running tasks", []
+{
+    for (auto size : { 1, 2, 4 })
+    {
+        test::reaver::work_stealing_pool pool{ static_cast<std::size_t>(size) };
+
+        std::atomic<std::size_t> count{ 0 };
+        std::promise<void> done;
+
+        for (std::size_t i = 0; i < 1000; ++i)
+        {
+            pool.push([&]{
+                if (++count == 1000)
+                {
+                    done.set_value();
+                }
+            });
+        }
+
+        done.get_future().get();
+        MAYFLY_REQUIRE(count == 1000);
+    }
+});
+
+MAYFLY_ADD_TESTCASE("tasks pushed from workers", []
+{
+    test::reaver::work_stealing_pool pool{ 4 };
+
+    std::atomic<std::size_t> count{ 0 };
+    std::promise<void> done;
+
+    pool.push([&]{
+        for (std::size_t i = 0; i < 100; ++i)
+        {
+            pool.push([&]{
+                for (std::size_t j = 0; j < 100; ++j)
+                {
+                    pool.push([&]{
+                        if (++count == 10000)
+                        {
+                            done.set_value();
+                        }
+                    });
+                }
+            });
+        }
+    });
+
+    done.get_future().get();
+    MAYFLY_REQUIRE(count == 10000);
+});
+
+MAYFLY_ADD_TESTCASE("bulk push", []
+{
+    test::reaver::work_stealing_pool pool{ 4 };
+
+    std::atomic<std::size_t> count{ 0 };
+    std::promise<void> done;
+
+    auto batch = [&]{
+        std::vector<test::reaver::function<void ()>> tasks;
+        for (std::size_t i = 0; i < 100; ++i)
+        {
+            tasks.emplace_back([&]{
+                if (++count == 200)
+                {
+                    done.set_value();
+                }
+            });
+        }
+
+        return tasks;
+    };
+
+    // once through the injection queue, once straight into a worker's deque
+    pool.push_bulk(batch());
+    pool.push([&]{ pool.push_bulk(batch()); });
+
+    done.get_future().get();
+    MAYFLY_REQUIRE(count == 200);
+});
+
+MAYFLY_ADD_TESTCASE("destruction drains the queues", []
+{
+    std::atomic<std::size_t> count{ 0 };
+
+    {
+        test::reaver::work_stealing_pool pool{ 2 };
+
+        for (std::size_t i = 0; i < 100; ++i)
+        {
+            pool.push([&]{
+                pool.push([&]{ ++count; });
+            });
+        }
+    }
+
+    MAYFLY_REQUIRE(count == 100);
+});
+
+MAYFLY_ADD_TESTCASE("as a future executor", []
+{
+    auto pool = test::reaver::make_executor<test::reaver::work_stealing_pool>(2);
+
+    auto future = test::reaver::async(pool, []{ return 1; })
+        .then(pool, [](auto i){ return i + 1; });
+
+    MAYFLY_REQUIRE(future.get() == 2);
+});
+
+MAYFLY_END_SUITE;